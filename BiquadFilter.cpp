@@ -9,12 +9,12 @@
 #include "BiquadFilter.h"
 
 BiquadFilter::BiquadFilter() :
-_fs(kBiquad_DefaultSampleRate), _type(kBiquadFilterType_LowPass),
+_fs(kBiquad_DefaultSampleRate),
 _fc(new SynthParameter("Cutoff Freq", kBiquad_DefaultSampleRate, 10000.0f, kBiquad_ParameterRampDuration)),
-_Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_ParameterRampDuration)) {
+_Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_ParameterRampDuration)),
+_type(kBiquadFilterType_LowPass), _coefficientsDirty(false) {
     
-    for (int i = 0; i < 2; i++)
-        _x[i] = _y[i] = 0.0f;
+    _z[0] = _z[1] = 0.0f;
     
     _fc->setRange(20.0f, 20000.0f);
     _Q->setRange(0.0f, 3.0f);
@@ -27,9 +27,10 @@ _Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_Para
 }
 
 BiquadFilter::BiquadFilter(BiquadFilterType type) :
-_fs(kBiquad_DefaultSampleRate), _type(type),
+_fs(kBiquad_DefaultSampleRate),
 _fc(new SynthParameter("Cutoff Freq", kBiquad_DefaultSampleRate, 10000.0f, kBiquad_ParameterRampDuration)),
-_Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_ParameterRampDuration)) {
+_Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_ParameterRampDuration)),
+_type(type), _coefficientsDirty(false) {
     
     _fc->setRange(20.0f, 20000.0f);
     _Q->setRange(0.0f, 3.0f);
@@ -44,12 +45,11 @@ _Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_Para
             break;
             
         default:
-            printf("%s: Invalid filter type\n", __PRETTY_FUNCTION__);
+            RealtimeLog::log(kLogLevel_Warning, "%s: Invalid filter type\n", __PRETTY_FUNCTION__);
             break;
     }
     
-    for (int i = 0; i < 2; i++)
-        _x[i] = _y[i] = 0.0f;
+    _z[0] = _z[1] = 0.0f;
     
     computeCoefficients();
     
@@ -59,15 +59,15 @@ _Q(new SynthParameter("Resonance", kBiquad_DefaultSampleRate, 1.0f, kBiquad_Para
 }
 
 BiquadFilter::BiquadFilter(BiquadFilterType type, float sampleRate, float cornerFreq, float resonance) :
-_fs(sampleRate), _type(type),
+_fs(sampleRate),
 _fc(new SynthParameter("Cutoff Freq", sampleRate, cornerFreq, kBiquad_ParameterRampDuration)),
-_Q(new SynthParameter("Resonance", sampleRate, resonance, kBiquad_ParameterRampDuration)) {
+_Q(new SynthParameter("Resonance", sampleRate, resonance, kBiquad_ParameterRampDuration)),
+_type(type), _coefficientsDirty(false) {
     
     _fc->setRange(20.0f, 20000.0f);
     _Q->setRange(0.0f, 3.0f);
     
-    for (int i = 0; i < 2; i++)
-        _x[i] = _y[i] = 0.0f;
+    _z[0] = _z[1] = 0.0f;
     
     computeCoefficients();
     
@@ -76,15 +76,13 @@ _Q(new SynthParameter("Resonance", sampleRate, resonance, kBiquad_ParameterRampD
     _Q->setParameterChangeListener(BiquadFilter::staticQChanged, (void *)this);
 }
 
-BiquadFilter::BiquadFilter(const BiquadFilter *o) : _fs(o->_fs), _fc(new SynthParameter(*o->_fc)), _Q(new SynthParameter(*o->_Q)), _type(o->_type) {
+BiquadFilter::BiquadFilter(const BiquadFilter *o) : _fs(o->_fs), _fc(new SynthParameter(*o->_fc)), _Q(new SynthParameter(*o->_Q)), _type(o->_type), _coefficientsDirty(false) {
     
     _fc->setRange(20.0f, 20000.0f);
     _Q->setRange(0.0f, 3.0f);
     
-    for (int i = 0; i < 2; i++) {
-        _x[i] = o->_x[i];
-        _y[i] = o->_y[i];
-    }
+    _z[0] = o->_z[0];
+    _z[1] = o->_z[1];
     
     computeCoefficients();
     
@@ -98,13 +96,13 @@ BiquadFilter::BiquadFilter(const BiquadFilter *o) : _fs(o->_fs), _fc(new SynthPa
 void BiquadFilter::setFilterType(BiquadFilterType type) {
     
     _type = type;
-    computeCoefficients();
+    _coefficientsDirty = true;
 }
 
 void BiquadFilter::setFc(float fc, bool doRamp) {
     
     if (fc <= 0.0f) {
-        printf("%s: Invalid corner frequency %f\n", __PRETTY_FUNCTION__, fc);
+        RealtimeLog::log(kLogLevel_Warning, "%s: Invalid corner frequency %f\n", __PRETTY_FUNCTION__, fc);
         return;
     }
     
@@ -113,13 +111,13 @@ void BiquadFilter::setFc(float fc, bool doRamp) {
     else
         *_fc = fc;
     
-    computeCoefficients();
+    _coefficientsDirty = true;
 }
 
 void BiquadFilter::setQ(float Q, bool doRamp) {
     
     if (Q <= 0.0f) {
-        printf("%s: Invalid filter Q %f\n", __PRETTY_FUNCTION__, Q);
+        RealtimeLog::log(kLogLevel_Warning, "%s: Invalid filter Q %f\n", __PRETTY_FUNCTION__, Q);
         return;
     }
     
@@ -128,16 +126,16 @@ void BiquadFilter::setQ(float Q, bool doRamp) {
     else
         *_Q = Q;
     
-    computeCoefficients();
+    _coefficientsDirty = true;
 }
 
+/* Parameter change listeners only flag the coefficients for recomputation */
 void BiquadFilter::fcChanged(float targetVal) {
-    computeCoefficients();
+    _coefficientsDirty = true;
 }
 
-
 void BiquadFilter::qChanged(float targetVal) {
-    computeCoefficients();
+    _coefficientsDirty = true;
 }
 
 void BiquadFilter::computeCoefficients() {
@@ -191,6 +189,21 @@ void BiquadFilter::computeCoefficients() {
             break;
             
     }
+    
+    /* Normalize by a0 so the difference equation doesn't divide */
+    if (_a[0] != 0.0f) {
+        _coef[0] = _b[0] / _a[0];
+        _coef[1] = _b[1] / _a[0];
+        _coef[2] = _b[2] / _a[0];
+        _coef[3] = _a[1] / _a[0];
+        _coef[4] = _a[2] / _a[0];
+    }
+    else {
+        for (int i = 0; i < 5; i++)
+            _coef[i] = 0.0f;
+    }
+    
+    _coefficientsDirty = false;
 }
 
 std::vector<SynthParameter*> BiquadFilter::getParameters() {
@@ -206,19 +219,73 @@ std::vector<SynthParameter*> BiquadFilter::getParameters() {
 
 void BiquadFilter::filterSample(float *sample) {
     
-    _x[1] = _x[0];
-    _x[0] = *sample;
+    if (_coefficientsDirty)
+        computeCoefficients();
+    
+    float x = *sample;
     
-    /* Direct form 1 difference equation */
-    *sample =   (_b[0] * *sample +
-                 _b[1] * _x[0] +
-                 _b[2] * _x[1] -
-                 _a[1] * _y[0] -
-                 _a[2] * _y[1])
-                / _a[0];
+    /* Transposed direct form II difference equation */
+    *sample = _coef[0] * x + _z[0];
+    _z[0] = flushState(_coef[1] * x - _coef[3] * *sample + _z[1]);
+    _z[1] = flushState(_coef[2] * x - _coef[4] * *sample);
+}
+
+bool BiquadFilter::blockCoefficients(int nFrames, float *coef, float *coefStep) {
+    
+    for (int k = 0; k < 5; k++) {
+        coef[k] = _coef[k];
+        coefStep[k] = 0.0f;
+    }
+    
+    if (!_coefficientsDirty || nFrames <= 0)
+        return false;
+    
+    /* Interpolate from the old coefficients to the new ones over the block. The stable region of (a1, a2) is convex, so every intermediate filter is stable if both ends are */
+    computeCoefficients();
+    
+    for (int k = 0; k < 5; k++)
+        coefStep[k] = (_coef[k] - coef[k]) / nFrames;
+    
+    return true;
+}
+
+void BiquadFilter::filterBlock(float *buffer, int nFrames) {
+    
+    float c[5], cStep[5];
+    float x, y;
+    float z0 = _z[0], z1 = _z[1];
+    
+    /* Interpolated coefficients */
+    if (blockCoefficients(nFrames, c, cStep)) {
+        
+        for (int i = 0; i < nFrames; i++) {
+            
+            for (int k = 0; k < 5; k++)
+                c[k] += cStep[k];
+            
+            x = buffer[i];
+            y = c[0] * x + z0;
+            z0 = c[1] * x - c[3] * y + z1;
+            z1 = c[2] * x - c[4] * y;
+            buffer[i] = y;
+        }
+    }
+    
+    /* Constant coefficients */
+    else {
+        
+        for (int i = 0; i < nFrames; i++) {
+            
+            x = buffer[i];
+            y = c[0] * x + z0;
+            z0 = c[1] * x - c[3] * y + z1;
+            z1 = c[2] * x - c[4] * y;
+            buffer[i] = y;
+        }
+    }
     
-    _y[1] = _y[0];
-    _y[0] = *sample;
+    _z[0] = flushState(z0);
+    _z[1] = flushState(z1);
 }
 
 void BiquadFilter::printStabilityWarning() {
@@ -226,10 +293,10 @@ void BiquadFilter::printStabilityWarning() {
     /* Stability of a biquad filter determined by the following conditions as noted in http://www.dafx.ca/proceedings/papers/p_057.pdf (Equation 2) */
     
     if (abs(_a[1]) >= (_a[2] + 1.0f))
-        printf("=== Warning: a1 is unstable (|a1| >= a2 + 1)\n");
+        RealtimeLog::log(kLogLevel_Warning, "=== Warning: a1 is unstable (|a1| >= a2 + 1)\n");
     
     if (abs(_a[2]) < 1)
-        printf("=== Warning: a2 is unstable (|a2| >= 1)\n");
+        RealtimeLog::log(kLogLevel_Warning, "=== Warning: a2 is unstable (|a2| >= 1)\n");
     
 }
 
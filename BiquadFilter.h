@@ -14,9 +14,11 @@
 #include <vector>
 
 #include "SynthParameter.h"
+#include "RealtimeLog.h"
 
 #define kBiquad_DefaultSampleRate 44100.0f
 #define kBiquad_ParameterRampDuration 0.1f
+#define kBiquad_StateFlushThreshold 1.0e-15f     // Filter state below this magnitude (about -300 dB) is flushed to zero
 
 typedef enum BiquadFilterType {
     kBiquadFilterType_LowPass = 0,
@@ -34,9 +36,11 @@ private:
     
     BiquadFilterType _type;     // LPF/HPF/BPF
     
-    /* Last two samples of the previous audio I/O buffers */
-    float _x[2];        // Input,   {x[n-1], x[n-2]}
-    float _y[2];        // Output,  {y[n-1], y[n-2]}
+    /* Transposed direct form II state */
+    float _z[2];
+    
+    /* Zero state values too small to affect the output, so a filter decaying toward silence never reaches denormal values, which are very slow to process on CPUs without flush-to-zero enabled */
+    static float flushState(float z) { return fabsf(z) < kBiquad_StateFlushThreshold ? 0.0f : z; }
     
     /* Intermediate parameters */
     float _omega;
@@ -46,6 +50,12 @@ private:
     float _a[3];
     float _b[3];
     
+    /* Coefficients normalized by a0 used by the difference equation, {b0, b1, b2, a1, a2} */
+    float _coef[5];
+    
+    /* Set when Fc, Q, or the filter type change. Coefficients are recomputed on the next call to filterSample() or filterBlock(), so they're computed at most once per sample or block however many times the parameters are updated */
+    bool _coefficientsDirty;
+    
     /* Static parameter change listeners for Fc and Q */
     static void staticFcChanged(float targetVal, void *userData) {
         BiquadFilter *filter = (BiquadFilter *)userData;
@@ -60,6 +70,11 @@ private:
     
     void computeCoefficients();
     void printStabilityWarning();
+    
+    /* Get the coefficients for the start of a block of nFrames and their per-sample increments. Recomputes the coefficients if they're dirty, in which case the increments interpolate to the new values by the end of the block; otherwise the increments are zero. Returns true if the coefficients change over the block */
+    bool blockCoefficients(int nFrames, float *coef, float *coefStep);
+    
+    friend class BiquadFilterBank;
    
 public:
     
@@ -77,6 +92,9 @@ public:
     std::vector<SynthParameter*> getParameters();
     
     void filterSample(float *sample);
+    
+    /* Filter nFrames samples in place. If the coefficients changed since the last call they're recomputed once and interpolated linearly across the block, which keeps the filter stable and avoids zipper noise when sweeping Fc or Q at control rate */
+    void filterBlock(float *buffer, int nFrames);
     void printCoefficients();
 };
 
@@ -0,0 +1,112 @@
+//
+//  BiquadFilterBank.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/23/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "BiquadFilterBank.h"
+
+void BiquadFilterBank::process(BiquadFilter **filters, float **buffers, int nFilters, int nFrames) {
+    
+    if (nFrames > kBiquadBank_MaxBlockSize)
+        nFrames = kBiquadBank_MaxBlockSize;
+    
+    if (nFrames <= 0)
+        return;
+    
+    for (int first = 0; first < nFilters; first += kBiquadBank_NumLanes) {
+        
+        int nLanes = std::min(nFilters - first, kBiquadBank_NumLanes);
+        
+        /* Lane-major coefficients {b0, b1, b2, a1, a2}, increments, and state. Unused lanes keep zero coefficients so they output silence */
+        float c[5][kBiquadBank_NumLanes] = { { 0.0f } };
+        float cStep[5][kBiquadBank_NumLanes] = { { 0.0f } };
+        float z[2][kBiquadBank_NumLanes] = { { 0.0f } };
+        float io[kBiquadBank_MaxBlockSize][kBiquadBank_NumLanes] __attribute__((aligned(16)));
+        
+        for (int l = 0; l < nLanes; l++) {
+            
+            BiquadFilter *f = filters[first + l];
+            float fc[5], fStep[5];
+            f->blockCoefficients(nFrames, fc, fStep);
+            
+            for (int k = 0; k < 5; k++) {
+                c[k][l] = fc[k];
+                cStep[k][l] = fStep[k];
+            }
+            z[0][l] = f->_z[0];
+            z[1][l] = f->_z[1];
+            
+            for (int i = 0; i < nFrames; i++)
+                io[i][l] = buffers[first + l][i];
+        }
+        
+        for (int l = nLanes; l < kBiquadBank_NumLanes; l++) {
+            for (int i = 0; i < nFrames; i++)
+                io[i][l] = 0.0f;
+        }
+        
+#if defined(__SSE__)
+        
+        __m128 b0 = _mm_loadu_ps(c[0]), b0Step = _mm_loadu_ps(cStep[0]);
+        __m128 b1 = _mm_loadu_ps(c[1]), b1Step = _mm_loadu_ps(cStep[1]);
+        __m128 b2 = _mm_loadu_ps(c[2]), b2Step = _mm_loadu_ps(cStep[2]);
+        __m128 a1 = _mm_loadu_ps(c[3]), a1Step = _mm_loadu_ps(cStep[3]);
+        __m128 a2 = _mm_loadu_ps(c[4]), a2Step = _mm_loadu_ps(cStep[4]);
+        __m128 z0 = _mm_loadu_ps(z[0]);
+        __m128 z1 = _mm_loadu_ps(z[1]);
+        __m128 x, y;
+        
+        for (int i = 0; i < nFrames; i++) {
+            
+            b0 = _mm_add_ps(b0, b0Step);
+            b1 = _mm_add_ps(b1, b1Step);
+            b2 = _mm_add_ps(b2, b2Step);
+            a1 = _mm_add_ps(a1, a1Step);
+            a2 = _mm_add_ps(a2, a2Step);
+            
+            /* Transposed direct form II */
+            x = _mm_load_ps(io[i]);
+            y = _mm_add_ps(_mm_mul_ps(b0, x), z0);
+            z0 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z1);
+            z1 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+            _mm_store_ps(io[i], y);
+        }
+        
+        _mm_storeu_ps(z[0], z0);
+        _mm_storeu_ps(z[1], z1);
+        
+#else
+        
+        /* Scalar fallback with the same lane layout so the compiler can auto-vectorize it */
+        float x, y;
+        for (int i = 0; i < nFrames; i++) {
+            for (int l = 0; l < kBiquadBank_NumLanes; l++) {
+                
+                for (int k = 0; k < 5; k++)
+                    c[k][l] += cStep[k][l];
+                
+                x = io[i][l];
+                y = c[0][l] * x + z[0][l];
+                z[0][l] = c[1][l] * x - c[3][l] * y + z[1][l];
+                z[1][l] = c[2][l] * x - c[4][l] * y;
+                io[i][l] = y;
+            }
+        }
+        
+#endif
+        
+        /* Scatter the output and write the state back to the filters */
+        for (int l = 0; l < nLanes; l++) {
+            
+            BiquadFilter *f = filters[first + l];
+            f->_z[0] = BiquadFilter::flushState(z[0][l]);
+            f->_z[1] = BiquadFilter::flushState(z[1][l]);
+            
+            for (int i = 0; i < nFrames; i++)
+                buffers[first + l][i] = io[i][l];
+        }
+    }
+}
@@ -0,0 +1,39 @@
+//
+//  BiquadFilterBank.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/23/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__BiquadFilterBank__
+#define __MRPSynthGUI__BiquadFilterBank__
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "BiquadFilter.h"
+
+#define kBiquadBank_MaxBlockSize 32     // Maximum number of frames per call to process()
+#define kBiquadBank_NumLanes 4          // Filters processed in parallel
+
+//! Runs several BiquadFilters in parallel
+/*!
+    Processes one block for a set of independent BiquadFilters (e.g. the filters of all sounding SubtractiveSynthVoices) four at a time, with one filter per SSE lane. Each filter's pre-normalized coefficients, coefficient increments, and transposed direct form II state are loaded into the lanes at the start of the block and its state is written back at the end, so the filters behave exactly as if each had called BiquadFilter::filterBlock() itself.
+
+    Input samples are gathered into a frame-major scratch buffer so each frame of four filters is a single aligned load. Blocks are limited to kBiquadBank_MaxBlockSize frames so the scratch buffer lives on the stack.
+*/
+class BiquadFilterBank {
+    
+public:
+    
+    /* Filter nFrames (at most kBiquadBank_MaxBlockSize) samples of buffers[i] in place with filters[i] for nFilters filters */
+    void process(BiquadFilter **filters, float **buffers, int nFilters, int nFrames);
+};
+
+#endif /* defined(__MRPSynthGUI__BiquadFilterBank__) */
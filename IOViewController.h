@@ -25,6 +25,11 @@
 #define kDefaultAudioOutputNumChannels 2
 #define kDefaultAudioOutputSampleRate 44100.0f
 
+#define kTouchkeyPressureControl 0              // PolySynth note control source carrying each key's analog position
+#define kTouchkeyLocationControl 1              // PolySynth note control source carrying the location of the first touch on each key
+#define kTouchkeyDefaultPressureChannel 14      // MIDI channel whose polyphonic aftertouch mappings the key positions use, clear of the low channels keyboards send on
+#define kTouchkeyDefaultLocationChannel 15      // MIDI channel whose polyphonic aftertouch mappings the touch locations use
+
 @interface IOViewController : NSViewController <NSApplicationDelegate> {
     
     /* Audio */
@@ -70,4 +75,8 @@
                 audio:(AudioController *)aCont
                  midi:(MIDIHandler *)mHandler;
 
+/* MIDI channel (0-15) whose polyphonic aftertouch mappings the TouchKeys key positions and touch locations are applied through, or -1 to ignore them. Pick channels no other input sends polyphonic aftertouch on */
+- (void)setTouchkeyPressureChannel:(int)channel;
+- (void)setTouchkeyLocationChannel:(int)channel;
+
 @end
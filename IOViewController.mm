@@ -77,6 +77,9 @@
     /* Set callbacks */
     touchkeyController->setCentroidCallback(touchkeyCentroidCallback, (__bridge void*) self);
     touchkeyController->setAnalogCallback(touchkeyAnalogCallback, (__bridge void*) self);
+    
+    [self setTouchkeyPressureChannel:kTouchkeyDefaultPressureChannel];
+    [self setTouchkeyLocationChannel:kTouchkeyDefaultLocationChannel];
 }
 
 - (void)midiSetup {
@@ -232,6 +235,16 @@
     touchkeyController->setLowestMidiNote(12*(startingOctave+1));
 }
 
+- (void)setTouchkeyPressureChannel:(int)channel {
+    
+    [midiHandler synth]->setNoteControlChannel(kTouchkeyPressureControl, channel);
+}
+
+- (void)setTouchkeyLocationChannel:(int)channel {
+    
+    [midiHandler synth]->setNoteControlChannel(kTouchkeyLocationControl, channel);
+}
+
 - (IBAction)touchkeyInputStart:(NSButton *)sender {
     
     if(touchkeyController->isAutoGathering()) {
@@ -501,25 +514,31 @@
 }
 
 #pragma mark - Touchkey Callbacks
-void touchkeyCentroidCallback(timestamp_type timeStamp, int midiNote, KeyTouchFrame frame, void *userData) {
+/* Hand per-note TouchKeys data (0-1) to the synth, which applies each note's latest value once per block to the voice playing the note. The frames bypass the MIDI event queue, so they can't fill it and cost note ons and offs */
+static void touchkeySetNoteControl(IOViewController *controller, int source, int midiNote, float value) {
     
-    printf("[t = %12.6f]\t\tnote: %3d\n---------------------------------\n", (float)timeStamp, midiNote);
+    [controller->midiHandler synth]->setNoteControl(source, midiNote, value);
+}
+
+void touchkeyCentroidCallback(timestamp_type timeStamp, int midiNote, KeyTouchFrame frame, void *userData) {
     
-    /* For each touch on this key */
-    for (int i = 0; i < frame.count; i++)
-        printf("touch %d (%d):\t\tloc.y = %f;\t\t size = %f\n",
-               i, frame.ids[i], frame.locs[i], frame.sizes[i]);
+    /* Called at the TouchKeys frame rate, so only the first touch is logged, without blocking on the console */
+    if (frame.count > 0)
+        RealtimeLog::log(kLogLevel_Debug, "[t = %12.6f] note: %3d touches: %d loc.y = %f size = %f loc.x = %f\n", (float)timeStamp, midiNote, frame.count, frame.locs[0], frame.sizes[0], frame.white ? frame.locH : -1.0f);
     
-    if (frame.white)
-        printf("loc.x = %f\n\n", frame.locH);
-    else
-        printf("\n\n");
+    /* Send the vertical touch location to the note's voice only */
+    if (frame.count > 0 && frame.locs[0] >= 0.0f)
+        touchkeySetNoteControl((__bridge IOViewController *)userData, kTouchkeyLocationControl, midiNote, frame.locs[0]);
 }
 
 void touchkeyAnalogCallback(timestamp_type timeStamp, int midiNote, float position, void *userData) {
     
     if (!isnan(position) && position > 0.1)
-        printf("[t = %12.6f]\t\tnote: %3d\t\tpos = %f\n", (float)timeStamp, midiNote, position);
+        RealtimeLog::log(kLogLevel_Debug, "[t = %12.6f] note: %3d pos = %f\n", (float)timeStamp, midiNote, position);
+    
+    /* Send the key's analog position to the note's voice only */
+    if (!isnan(position))
+        touchkeySetNoteControl((__bridge IOViewController *)userData, kTouchkeyPressureControl, midiNote, position);
 }
 
 #pragma mark - MIDI Parameter Events
@@ -10,6 +10,7 @@
 
 #include "RtMidi.h"
 #include "PolySynth.h"
+#include "MidiOutputQueue.h"
 
 #define kMRPMIDIOutputChannel 0
 
@@ -50,11 +51,15 @@ enum {
     
     RtMidiIn *_midiIn;                      // Main MIDI Input
     RtMidiOut *_midiOut;                    // Main MIDI Output
+    MidiOutputQueue *_outputQueue;          // Coalesces and sends messages to _midiOut from its own thread
     
     std::vector<RtMidiIn*> _midiInputs;     // Secondary MIDI Inputs
     
     std::vector<std::string> _inputDeviceNames;
     std::vector<std::string> _outputDeviceNames;
+    
+    dispatch_queue_t _routingQueue;         // Serial queue that sends MRP routing messages for voices allocated by the audio thread
+    dispatch_source_t _routingSource;       // Merged by the audio thread when it allocates voices. Its handler runs on _routingQueue
 }
 
 @property BOOL isRunning;
@@ -70,6 +75,7 @@ enum {
 - (bool)openSecondaryInputDevice:(int)devIdx;
 - (bool)setOutputDevice:(int)devIdx;
 - (bool)sendMRPRoutingMessage:(int)channel string:(int)string;
+- (void)sendPendingRoutingMessages;
 
 - (std::vector<std::string>)getInputDeviceNames;
 - (std::vector<std::string>)getOutputDeviceNames;
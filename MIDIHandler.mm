@@ -36,23 +36,21 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
             byte2 = (int)message->at(1);
             byte3 = (int)message->at(2);
             
-            printf("Note ON: %2x %2x %2x\n", statusByte, byte2, byte3);
+            RealtimeLog::log(kLogLevel_Debug, "Note ON: %2x %2x %2x\n", statusByte, byte2, byte3);
             if (message->at(2) == 0)
-                [midi synth]->noteOff(byte2);
+                [midi synth]->queueNoteOff(byte2);
             
-            else {
-                /* PolySynth::noteOn() returns the index of the audio channel allocated for this note. Use it and the MIDI note number to send the MRP routing message after allocation. */
-                int channel = [midi synth]->noteOn(byte2, byte3);
-                [midi sendMRPRoutingMessage:channel string:byte2-21];
-            }
+            /* The audio thread allocates the voice when it drains the queue. The MRP routing message is sent once the allocation is reported back (see -sendPendingRoutingMessages). Queue the raw message so the synth knows the note's MIDI channel for per-note control */
+            else
+                [midi synth]->queueEvent(message->data(), 3, PolySynth::hostTime());
             break;
             
         case kMESSAGE_CONTROL_CHANGE:
             
-            printf("Control: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
+            RealtimeLog::log(kLogLevel_Debug, "Control: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
             
-            /* Forward the control message to PolySynth::handleMidiControl(), which returns a vector<pair<string, int>> with the name and updated value of any parameters that were updated. Use this vector to update the UI accordingly via the SynthVoiceMappingDelegate protocol */
-            updatedParams = [midi synth]->handleMidiControl(message);
+            /* Forward the control message to PolySynth::queueMidiControl(), which returns a vector<pair<string, int>> with the name and updated value of any parameters that were updated. Use this vector to update the UI accordingly via the SynthVoiceMappingDelegate protocol */
+            updatedParams = [midi synth]->queueMidiControl(message);
             for (int i = 0; i < updatedParams.size(); i++) {
                 
                 if ([midi voiceViewController] != nil) {
@@ -64,12 +62,21 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
             
         case kMESSAGE_PITCHWHEEL:
             
-            printf("Pitch Wheel: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
-            [midi synth]->handleMidiControl(message);
+            RealtimeLog::log(kLogLevel_Debug, "Pitch Wheel: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
+            [midi synth]->queueMidiControl(message);
+            break;
+            
+        /* Polyphonic aftertouch (and pitch wheel, channel pressure or control messages on the synth's per-note channels) only reach the voice playing the message's note */
+        case kMESSAGE_AFTERTOUCH_POLY:
+            
+            RealtimeLog::log(kLogLevel_Debug, "Poly Aftertouch: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
+            [midi synth]->queueMidiControl(message);
             break;
             
         case kMESSAGE_AFTERTOUCH_CHANNEL:
             
+            RealtimeLog::log(kLogLevel_Debug, "Channel Aftertouch: %2x %2x\n", statusByte, message->at(1));
+            [midi synth]->queueMidiControl(message);
             break;
             
         default:
@@ -87,6 +94,13 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
     return;
 }
 
+#pragma mark - Voice Allocation Listener
+/* Called on the audio thread after it allocates voices. Merging into a data source never blocks or allocates, so it is safe there */
+static void voiceAllocationListener(void *userData) {
+    
+    dispatch_source_merge_data((__bridge dispatch_source_t)userData, 1);
+}
+
 @implementation MIDIHandler
 
 @synthesize isRunning = _isRunning;
@@ -118,15 +132,44 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
             return nil;
         }
         
+        _outputQueue = new MidiOutputQueue();
+        
         if (![self rescanInputDevices])
             printf("%s: No MIDI input devices\n", __PRETTY_FUNCTION__);
         if (![self rescanOutputDevices])
             printf("%s: No MIDI output devices\n", __PRETTY_FUNCTION__);
+        
+        /* Send routing messages for voices allocated by the audio thread on a serial queue of our own, so they don't wait on (or add work to) the main thread. The audio thread merges into the source after queueing allocations, and merges that arrive while the handler is pending coalesce into one call. The handler only holds a weak reference, so it doesn't keep the MIDIHandler alive */
+        _routingQueue = dispatch_queue_create("MIDIHandler.routing", DISPATCH_QUEUE_SERIAL);
+        _routingSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0, _routingQueue);
+        
+        __weak MIDIHandler *weakSelf = self;
+        dispatch_source_set_event_handler(_routingSource, ^{
+            [weakSelf sendPendingRoutingMessages];
+        });
+        dispatch_resume(_routingSource);
+        
+        _synth->setVoiceAllocationListener(&voiceAllocationListener, (__bridge void *)_routingSource);
     }
     
     return self;
 }
 
+- (void)dealloc {
+    
+    /* Stop the audio thread's wakeups before the handler goes away. A handler call in progress holds a strong reference to the MIDIHandler, so none can be running here */
+    if (_routingSource) {
+        _synth->setVoiceAllocationListener(NULL, NULL);
+        dispatch_source_cancel(_routingSource);
+    }
+    
+    /* Send anything still queued and detach the output, then stop the flush thread */
+    if (_outputQueue) {
+        _outputQueue->setOutput(NULL);
+        delete _outputQueue;
+    }
+}
+
 - (PolySynth *)synth {
     return _synth;
 }
@@ -228,6 +271,9 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
         return false;
     }
     
+    /* Detach the output from the flush thread while the port changes */
+    _outputQueue->setOutput(NULL);
+    
     /* Open the device */
     try {
         _midiOut->openPort(devIdx);
@@ -238,6 +284,8 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
         return false;
     }
     
+    _outputQueue->setOutput(_midiOut);
+    
     printf("%s: Using MIDI output device %s\n", __PRETTY_FUNCTION__, _outputDeviceNames[devIdx].c_str());
     
     return true;
@@ -251,6 +299,15 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
     return _outputDeviceNames;
 }
 
+/* Called on _routingQueue, which is the only thread that takes voice allocations from the synth */
+- (void)sendPendingRoutingMessages {
+    
+    int midiNum, channel;
+    
+    while (_synth->nextVoiceAllocation(&midiNum, &channel))
+        [self sendMRPRoutingMessage:channel string:midiNum-21];
+}
+
 - (bool)sendMRPRoutingMessage:(int)channel string:(int)string {
     
     /* Make sure the RtMidiOut instance exists */
@@ -266,21 +323,16 @@ static void midiInputCallback(double deltaTime, std::vector<unsigned char> *mess
     }
     
     /* Construct MRP routing message */
-    vector<unsigned char> message;
-    message.push_back(kMESSAGE_CONTROL_CHANGE | (unsigned char)kMRPMIDIOutputChannel);
-    message.push_back(kCONTROL_MRP_BASE + (unsigned char)channel);
-    message.push_back((unsigned char)(string & 0xFF));
+    unsigned char message[3];
+    message[0] = kMESSAGE_CONTROL_CHANGE | (unsigned char)kMRPMIDIOutputChannel;
+    message[1] = kCONTROL_MRP_BASE + (unsigned char)channel;
+    message[2] = (unsigned char)(string & 0xFF);
     
     //    printf("%s: Sending MRP routing message %u %u %u\n", __PRETTY_FUNCTION__, message[0], message[1], message[2]);
     
-    /* Send the message */
-    try {
-        _midiOut->sendMessage(&message);
-    }
-    catch(RtMidiError& err) {
-        printf("%s: Error sending MRP routing message. RtMidiError: ", __PRETTY_FUNCTION__);
-        err.printMessage();
-        printf("\n");
+    /* Queue the message. Repeated routing of the same channel within one flush interval is coalesced */
+    if (!_outputQueue->queueMessage(message, 3)) {
+        printf("%s: Error sending MRP routing message. MIDI output queue is full.\n", __PRETTY_FUNCTION__);
         return false;
     }
     
@@ -0,0 +1,70 @@
+//
+//  main.cpp
+//  MRPRender
+//
+//  Created by Jeff Gregorio on 10/30/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+/* Headless driver for the OfflineRenderer: renders a standard MIDI file to a 32-bit float WAV file with one channel per voice, without an audio device or the GUI. Builds anywhere the synth does, e.g.
+
+    c++ -std=gnu++11 -O2 -IMRPSynth -IRtMidi -I. MRPRender/main.cpp $(ls MRPSynth/*.cpp | grep -v AudioController) BiquadFilter.cpp BiquadFilterBank.cpp SubtractiveSynthVoice.cpp EffectBase.cpp RtMidi/ParameterList.cpp -lpthread -o mrprender
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "OfflineRenderer.h"
+#include "RealtimeLog.h"
+
+#define kMRPRender_NumHarmonics 8       // Same as the GUI's voices
+
+static void printUsage(const char *name) {
+    printf("usage: %s <MIDI file> <WAV file> <sample rate> <channels> [additive|subtractive]\n", name);
+}
+
+int main(int argc, const char * argv[]) {
+    
+    if (argc < 5 || argc > 6) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    int fs = atoi(argv[3]);
+    int nChannels = atoi(argv[4]);
+    std::string voiceType = argc > 5 ? argv[5] : "subtractive";
+    
+    if (fs <= 0 || nChannels <= 0 || (voiceType != "additive" && voiceType != "subtractive")) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    RealtimeLog::start();
+    
+    /* Each channel is a voice, as with a live stream */
+    SynthVoice *master;
+    if (voiceType == "additive")
+        master = new AdditiveSynthVoice(kMRPRender_NumHarmonics);
+    else
+        master = new SubtractiveSynthVoice(kMRPRender_NumHarmonics);
+    
+    PolySynth *synth = new PolySynth();
+    synth->setSampleRate(fs);
+    synth->setNumVoices(nChannels);
+    synth->setMasterVoice(master);
+    
+    OfflineRenderer renderer(synth);
+    bool success = renderer.loadMidiFile(argv[1]);
+    
+    if (!success)
+        printf("%s: Can't read MIDI file %s\n", argv[0], argv[1]);
+    else if (!(success = renderer.render(argv[2], kOfflineFileFormat_Wav)))
+        printf("%s: Can't write WAV file %s\n", argv[0], argv[2]);
+    
+    delete synth;
+    delete master;
+    
+    RealtimeLog::stop();
+    
+    return success ? 0 : 1;
+}
@@ -27,7 +27,7 @@ ADSREnvelope::ADSREnvelope(float fs) : EffectBase("ADSR"), _state(kADSRPhase_Att
     _rel->setRange(0.01f, 2.0f);
 }
 
-ADSREnvelope::ADSREnvelope(float fs, float atk, float dec, float sus, float rel) : EffectBase("ADSR"), _fs(fs), _timeInState(0.0f), _releaseAmp(0.0f), _amp(SynthParameter("Amplitude", fs, 0.0f, kADSR_ParameterRampDuration)), _atk(new SynthParameter("Attack", fs, atk, kADSR_ParameterRampDuration)), _dec(new SynthParameter("Decay", fs, dec, kADSR_ParameterRampDuration)), _sus(new SynthParameter("Sustain", fs, sus, kADSR_ParameterRampDuration)), _rel(new SynthParameter("Release", fs, rel, kADSR_ParameterRampDuration)) {
+ADSREnvelope::ADSREnvelope(float fs, float atk, float dec, float sus, float rel) : EffectBase("ADSR"), _state(kADSRPhase_Attack), _fs(fs), _timeInState(0.0f), _releaseAmp(0.0f), _amp(SynthParameter("Amplitude", fs, 0.0f, kADSR_ParameterRampDuration)), _atk(new SynthParameter("Attack", fs, atk, kADSR_ParameterRampDuration)), _dec(new SynthParameter("Decay", fs, dec, kADSR_ParameterRampDuration)), _sus(new SynthParameter("Sustain", fs, sus, kADSR_ParameterRampDuration)), _rel(new SynthParameter("Release", fs, rel, kADSR_ParameterRampDuration)) {
     
     _amp.setRange(0.0f, 1.0f);
     _atk->setRange(0.01f, 2.0f);
@@ -36,7 +36,7 @@ ADSREnvelope::ADSREnvelope(float fs, float atk, float dec, float sus, float rel)
     _rel->setRange(0.01f, 2.0f);
 }
 
-ADSREnvelope::ADSREnvelope(const ADSREnvelope* o) : EffectBase("ADSR"), _fs(o->_fs), _timeInState(o->_timeInState), _releaseAmp(o->_releaseAmp), _amp(SynthParameter(o->_amp)), _atk(new SynthParameter(*o->_atk)), _dec(new SynthParameter(*o->_dec)), _sus(new SynthParameter(*o->_sus)), _rel(new SynthParameter(*o->_rel)) {
+ADSREnvelope::ADSREnvelope(const ADSREnvelope* o) : EffectBase("ADSR"), _state(o->_state), _fs(o->_fs), _timeInState(o->_timeInState), _releaseAmp(o->_releaseAmp), _amp(SynthParameter(o->_amp)), _atk(new SynthParameter(*o->_atk)), _dec(new SynthParameter(*o->_dec)), _sus(new SynthParameter(*o->_sus)), _rel(new SynthParameter(*o->_rel)) {
     
     _amp.setRange(_amp.minVal(), _amp.maxVal());
     _atk->setRange(_atk->minVal(), _atk->maxVal());
@@ -144,6 +144,106 @@ bool ADSREnvelope::update() {
     return cont;
 }
 
+/* The per-sample state change condition (_timeInState > duration) is first met after this many more updates */
+int ADSREnvelope::segmentSamplesLeft(float duration) {
+    
+    int left = (int)floorf((duration - _timeInState) * _fs) + 1;
+    return left < 1 ? 1 : left;
+}
+
+float ADSREnvelope::segmentStep() {
+    
+    switch (_state) {
+        case kADSRPhase_Attack:
+            return (1.0f / *_atk) / _fs;
+        case kADSRPhase_Decay:
+            return ((*_sus - 1.0f) / *_dec) / _fs;
+        case kADSRPhase_Release:
+            return ((0.0f - _releaseAmp) / *_rel) / _fs;
+        default:
+            return 0.0f;
+    }
+}
+
+bool ADSREnvelope::update(float *gains, int nFrames) {
+    
+    int i = 0;
+    
+    while (i < nFrames) {
+        
+        int remaining = nFrames - i;
+        float amp = _amp.value();
+        
+        /* Sustain lasts until beginRelease(). If the sustain level changes, ramp the amplitude to it */
+        if (_state == kADSRPhase_Sustain) {
+            
+            if ((fabs(_amp - *_sus) > 0.02))
+                _amp.setValue(*_sus);
+            
+            _amp.ramp(remaining);
+            
+            if (gains) {
+                float step = (_amp.value() - amp) / remaining;
+                for (int j = 0; j < remaining; j++)
+                    gains[i + j] = amp + j * step;
+            }
+            
+            _timeInState += remaining / _fs;
+            break;
+        }
+        
+        /* Timed segments ramp linearly until their duration is exceeded */
+        float duration = _state == kADSRPhase_Attack ? _atk->value() : _state == kADSRPhase_Decay ? _dec->value() : _rel->value();
+        int left = segmentSamplesLeft(duration);
+        int n = left < remaining ? left : remaining;
+        float step = segmentStep();
+        
+        if (gains) {
+            for (int j = 0; j < n; j++)
+                gains[i + j] = amp + j * step;
+        }
+        
+        _amp += n * step;
+        _timeInState += n / _fs;
+        i += n;
+        
+        /* State change */
+        if (n == left) {
+            
+            _timeInState = 0.0f;
+            
+            if (_state == kADSRPhase_Attack)
+                _state = kADSRPhase_Decay;
+            
+            else if (_state == kADSRPhase_Decay)
+                _state = kADSRPhase_Sustain;
+            
+            /* Release finished */
+            else {
+                if (gains) {
+                    for (; i < nFrames; i++)
+                        gains[i] = 0.0f;
+                }
+                return false;
+            }
+        }
+    }
+    
+    return true;
+}
+
+float ADSREnvelope::maxRemainingAmplitude() const {
+    
+    switch (_state) {
+        case kADSRPhase_Attack:
+            return 1.0f;
+        case kADSRPhase_Release:
+            return _amp.value();
+        default:
+            return std::max(_amp.value(), std::max(_sus->value(), _sus->targetValue()));
+    }
+}
+
 #pragma mark - State control
 void ADSREnvelope::beginAttack() {
     
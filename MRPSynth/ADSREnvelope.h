@@ -11,6 +11,7 @@
 
 #include <iostream>
 #include <math.h>
+#include <algorithm>
 
 #include "EffectBase.h"
 
@@ -43,6 +44,10 @@ class ADSREnvelope : EffectBase {
     
     float _releaseAmp;
     
+    /* Number of updates before the current timed segment (attack, decay, or release) ends, and the amplitude increment per update */
+    int segmentSamplesLeft(float duration);
+    float segmentStep();
+    
 public:
     
 #pragma mark - Constructors/Desctructors
@@ -60,6 +65,9 @@ public:
     float sus() const { return _sus->value(); }
     float rel() const { return _rel->value(); }
     
+    /* Highest amplitude the envelope can reach before the next beginAttack(): the peak during attack, the larger of the current and sustain levels during decay and sustain, and the current level during release */
+    float maxRemainingAmplitude() const;
+    
 #pragma mark - Setters
     void setSampleRate(float fs);
     void setAttack(float atk, bool doRamp);
@@ -72,6 +80,9 @@ public:
     bool update();
     bool update(int nSamples);
     
+    /* Update the envelope state for a block of nFrames samples, writing the amplitude each sample would see from currentAmplitude() before calling update() to gains (which may be NULL). Each segment's amplitude increment and remaining length are computed once per block (or segment), so there's no per-sample branching or division. The A, D, S, and R parameters aren't ramped here, as they're ramped with the voice's parameter list. Returns false if release finished within the block, in which case the remaining gains are zero */
+    bool update(float *gains, int nFrames);
+    
 #pragma mark - State control
     void beginAttack();
     void beginRelease();
@@ -11,16 +11,13 @@
 
 #include <iostream>
 #include <vector>
-#include "SynthVoice.h"
+#include "HarmonicSynthVoice.h"
 
 //! Monophonic additive synthesizer voice with specified number of harmonics
 /*!
 
 */
-class AdditiveSynthVoice : public SynthVoice {
-    
-    int _numHarmonics;                              // Number of harmonics
-    std::vector<SynthParameter*> _harmonicAmps;     // Harmonic amplitudes
+class AdditiveSynthVoice : public HarmonicSynthVoice {
     
 public:
     
@@ -30,12 +27,11 @@ public:
     AdditiveSynthVoice(const AdditiveSynthVoice *master);
     ~AdditiveSynthVoice() {};
     
-    int numHarmonics() { return _numHarmonics; }
-    
-    void setNumHarmonics(float num);
-    void setHarmonicAmp(int harmonicNumber, float amp);
+    SynthVoice* clone(void *mem) const { return new (mem) AdditiveSynthVoice(this); }
+    size_t cloneSize() const { return sizeof(AdditiveSynthVoice); }
     
     int renderSample(float *outSample);
+    int renderBlock(float *outBuffer, int nFrames);
     
 };
 
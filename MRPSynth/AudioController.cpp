@@ -8,7 +8,7 @@
 
 #include "AudioController.h"
 
-AudioController::AudioController() : _synth(nullptr), _nOutputChannels(0), _fs(44100.0f), _streamIsOpen(false) {
+AudioController::AudioController() : _synth(nullptr), _nOutputChannels(0), _fs(44100.0f), _streamIsOpen(false), _preferNonInterleaved(true) {
     
     _globalAmp = SynthParameter("Global Amplitude", _fs, 1.0f, kAudioController_GlobalAmpRampTime);
     
@@ -16,7 +16,7 @@ AudioController::AudioController() : _synth(nullptr), _nOutputChannels(0), _fs(4
     paSetup();
 }
 
-AudioController::AudioController(PolySynth* synth) : _synth(synth), _nOutputChannels(0), _fs(44100.0f), _streamIsOpen(false) {
+AudioController::AudioController(PolySynth* synth) : _synth(synth), _nOutputChannels(0), _fs(44100.0f), _streamIsOpen(false), _preferNonInterleaved(true) {
     
     _globalAmp = SynthParameter("Global Amplitude", _fs, 1.0f, kAudioController_GlobalAmpRampTime);
     
@@ -56,7 +56,7 @@ PaError AudioController::paSetup() {
     _outputStreamParams.channelCount = 0;
     _outputStreamParams.device = paNoDevice;
     _outputStreamParams.hostApiSpecificStreamInfo = NULL;
-    _outputStreamParams.sampleFormat = paFloat32; // | paNonInterleaved;
+    _outputStreamParams.sampleFormat = paFloat32;     // Non-interleaved flag is added in openStream() if the device supports it
     _outputStreamParams.suggestedLatency = NULL;
     
     /* ------------------------------------------ */
@@ -75,9 +75,23 @@ PaError AudioController::paSetup() {
     _theta = 0.0f;
     _thetaInc = 2*M_PI * 440.0f / _fs;
     
+    allocateChannelBuffers();
+    
     return error;
 }
 
+/* Allocate the per-channel render buffers up front so the render callback doesn't allocate */
+void AudioController::allocateChannelBuffers() {
+    
+    int nChannels = std::max(_nOutputChannels, 1);
+    
+    _channelBuffer.resize(nChannels * kAudioController_AudioBufferSizeFrames);
+    _channelPtrs.resize(nChannels);
+    
+    for (int ch = 0; ch < nChannels; ch++)
+        _channelPtrs[ch] = &_channelBuffer[ch * kAudioController_AudioBufferSizeFrames];
+}
+
 #pragma mark - Portaudio Callback
 int AudioController::renderCallback(const void* input, void* output,
                                     unsigned long frameCount,
@@ -86,37 +100,46 @@ int AudioController::renderCallback(const void* input, void* output,
     if (!_synth)
         return 1;
     
-    /* Typecast and initialize the output to zeros */
-    float* out = (float*)output;
-    bzero(out, frameCount * _nOutputChannels * sizeof(float));
-    
-    /* Call the PolySynth to render single samples from the voice assigned to each channel */
-    for (int i = 0; i < frameCount; i++) {
+    /* Non-interleaved streams pass a list of pointers to separate channel buffers, so each voice can render straight into its own channel */
+    if (_outputStreamParams.sampleFormat & paNonInterleaved) {
+        
+        float** channelPtr = (float**)output;
+        
+        _synth->renderBlock(channelPtr, _nOutputChannels, (int)frameCount);
+        
         for (int ch = 0; ch < _nOutputChannels; ch++) {
-            *out++ = _globalAmp * _synth->renderSample(ch);
+            
+            float* chOut = channelPtr[ch];
+            for (int i = 0; i < frameCount; i++)
+                chOut[i] *= _globalAmp.value();
         }
+        
+        return 0;
     }
     
-    return 0;
+    /* Otherwise the output is a single interleaved buffer */
+    float* out = (float*)output;
     
-#pragma mark Fix Me: Non-interleaved audio
+    /* Call the PolySynth to render a block from the voice assigned to each channel into the scratch buffers, then interleave them into the output buffer. Portaudio should always ask for kAudioController_AudioBufferSizeFrames, but render in chunks of the scratch buffer size in case it doesn't */
+    unsigned long maxFrames = kAudioController_AudioBufferSizeFrames;
+    int nChannels = std::min(_nOutputChannels, (int)_channelPtrs.size());
     
-//    printf("frameCount = %lu\n", frameCount);
-//    
-//    /* Using _outputStreamParams.sampleFormat = paNonInterleaved makes void* output a list of pointers to separate non-interleaved channel buffers */
-//    float** channelPtr = (float**)output;
-//
-//    /* For each output channel, call the PolySynth's render() method on each voice mapped to that channel */
-//    for (int ch = 0; ch < _nOutputChannels; ch++) {
-//    
-//        float* chOut = (float*)channelPtr[ch];
-//        memset(chOut, 0.0f, frameCount * sizeof(float));    // Initialize to zero
-//    
-//        /* Render from the synth voice mapped to this channel */
-//        _synth->render(ch, chOut, (int)frameCount);
-//    }
-//
-//    return 0;
+    for (unsigned long offset = 0; offset < frameCount; offset += maxFrames) {
+        
+        int nFrames = (int)std::min(maxFrames, frameCount - offset);
+        
+        _synth->renderBlock(&_channelPtrs[0], nChannels, nFrames);
+        
+        for (int ch = 0; ch < nChannels; ch++) {
+            
+            float* chBuffer = _channelPtrs[ch];
+            float* chOut = out + offset * _nOutputChannels + ch;
+            for (int i = 0; i < nFrames; i++)
+                chOut[i * _nOutputChannels] = _globalAmp * chBuffer[i];
+        }
+    }
+    
+    return 0;
 }
 
 #pragma mark - Interface Methods
@@ -261,6 +284,7 @@ bool AudioController::setNumOutputChannels(int nChannels) {
         closeStream();
     }
     
+    allocateChannelBuffers();
     openStream();
     
     if (wasActive)
@@ -363,6 +387,18 @@ bool AudioController::openStream() {
         return false;
     }
     
+    /* Prefer non-interleaved output so voices render directly into contiguous channel buffers. Fall back to interleaved output for devices that don't support it */
+    _outputStreamParams.sampleFormat = paFloat32;
+    if (_preferNonInterleaved) {
+        
+        _outputStreamParams.sampleFormat |= paNonInterleaved;
+        
+        if (Pa_IsFormatSupported(NULL, &_outputStreamParams, _fs) != paFormatIsSupported) {
+            printf("%s: Device %s doesn't support non-interleaved output. Using interleaved output\n", __PRETTY_FUNCTION__, _devices[_outputStreamParams.device]->name);
+            _outputStreamParams.sampleFormat = paFloat32;
+        }
+    }
+    
     printStreamParameters(_outputStreamParams, "\n== Opening output stream with parameters:");
     
     /* Open the stream, passing the static render callback method and output stream parameters */
@@ -434,6 +470,29 @@ bool AudioController::stopAudioRender() {
     return true;
 }
 
+bool AudioController::setPreferNonInterleaved(bool prefer) {
+    
+    if (prefer == _preferNonInterleaved)
+        return true;
+    
+    _preferNonInterleaved = prefer;
+    
+    /* Reopen the stream with the new sample format if it's already open */
+    if (_streamIsOpen) {
+        
+        bool wasActive = Pa_IsStreamActive(_stream);
+        closeStream();
+        
+        if (!openStream())
+            return false;
+        
+        if (wasActive)
+            return startAudioRender();
+    }
+    
+    return true;
+}
+
 void AudioController::setGlobalAmplitude(float amp, bool doRamp) {
     
     if (doRamp)
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <portaudio.h>
 #include <assert.h>
 
@@ -28,6 +29,7 @@ class AudioController {
     PaStream* _stream;                                  // Port audio stream
     bool _streamIsOpen;                                 // Whether the audio output stream is open
     PaStreamParameters _outputStreamParams;             // Output audio stream parameters
+    bool _preferNonInterleaved;                         // Whether to open non-interleaved streams when the device supports it
     std::vector<const PaDeviceInfo*> _devices;          // Available audio devices
     std::vector<std::pair<const PaDeviceInfo*, PaDeviceIndex> > _outputDevices;    // Available audio output devices and their indices in the available I/O devices list
     
@@ -36,6 +38,9 @@ class AudioController {
     
     PolySynth* _synth;
     
+    std::vector<float> _channelBuffer;          // Scratch buffers for rendering each channel's block before interleaving (interleaved streams only)
+    std::vector<float*> _channelPtrs;           // Start of each channel's scratch buffer
+    
     /* Temp */
     float _theta;
     float _thetaInc;
@@ -43,6 +48,7 @@ class AudioController {
     
 #pragma mark - Private Methods
     PaError paSetup();
+    void allocateChannelBuffers();
     void printStreamParameters(PaStreamParameters _params, std::string title);
     
 #pragma mark - Portaudio Callback
@@ -92,6 +98,10 @@ public:
     bool startAudioRender();
     bool stopAudioRender();
     
+    /* Non-interleaved output is used when supported by the device. Disabling it forces the interleaved render path */
+    bool setPreferNonInterleaved(bool prefer);
+    bool isNonInterleaved() { return _streamIsOpen && (_outputStreamParams.sampleFormat & paNonInterleaved); }
+    
     bool streamIsOpen() { return _streamIsOpen; }
     bool isRendering() { return Pa_IsStreamActive(&_stream); }
     
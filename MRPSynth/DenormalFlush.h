@@ -0,0 +1,53 @@
+//
+//  DenormalFlush.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/27/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__DenormalFlush__
+#define __MRPSynthGUI__DenormalFlush__
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define kDenormalFlush_FTZ 0x8000       // MXCSR flush-to-zero bit
+#define kDenormalFlush_DAZ 0x0040       // MXCSR denormals-are-zero bit
+#define kDenormalFlush_FZ (1 << 24)     // ARMv8 FPCR flush-to-zero bit
+
+//! Treats denormal floats as zero on the current thread while in scope
+/*!
+    Decaying filter states and envelope tails eventually reach denormal values, which many CPUs process tens of times slower than normal floats. The constructor sets the flush-to-zero and denormals-are-zero modes on the calling thread, and the destructor restores the previous modes, so it can wrap a render call without changing the floating point behaviour of the code that called it. Has no effect on other architectures.
+*/
+class DenormalFlush {
+    
+#if defined(__SSE__)
+    unsigned int _savedMode;
+#elif defined(__aarch64__)
+    unsigned long _savedMode;
+#endif
+    
+public:
+    
+    DenormalFlush() {
+#if defined(__SSE__)
+        _savedMode = _mm_getcsr();
+        _mm_setcsr(_savedMode | kDenormalFlush_FTZ | kDenormalFlush_DAZ);
+#elif defined(__aarch64__)
+        asm volatile("mrs %0, fpcr" : "=r"(_savedMode));
+        asm volatile("msr fpcr, %0" : : "r"(_savedMode | kDenormalFlush_FZ));
+#endif
+    }
+    
+    ~DenormalFlush() {
+#if defined(__SSE__)
+        _mm_setcsr(_savedMode);
+#elif defined(__aarch64__)
+        asm volatile("msr fpcr, %0" : : "r"(_savedMode));
+#endif
+    }
+};
+
+#endif /* defined(__MRPSynthGUI__DenormalFlush__) */
@@ -0,0 +1,176 @@
+//
+//  HarmonicOscillatorBank.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/20/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "HarmonicOscillatorBank.h"
+
+#pragma mark - Constructors
+HarmonicOscillatorBank::HarmonicOscillatorBank() : _numHarmonics(0), _numPadded(0) {
+    setNumHarmonics(1);
+}
+
+HarmonicOscillatorBank::HarmonicOscillatorBank(int numHarmonics) : _numHarmonics(0), _numPadded(0) {
+    setNumHarmonics(numHarmonics);
+}
+
+#pragma mark - Setters
+void HarmonicOscillatorBank::setNumHarmonics(int num) {
+    
+    if (num < 0)
+        num = 0;
+    
+    _numHarmonics = num;
+    _numPadded = (num + 3) & ~3;
+    
+    /* Padding harmonics keep zero amplitude so they never contribute to the output */
+    _sin.assign(_numPadded, 0.0f);
+    _cos.assign(_numPadded, 0.0f);
+    _sinInc.assign(_numPadded, 0.0f);
+    _cosInc.assign(_numPadded, 0.0f);
+    _amp.assign(_numPadded, 0.0f);
+    _ampInc.assign(_numPadded, 0.0f);
+}
+
+int HarmonicOscillatorBank::numBandLimitedHarmonics(float f0) {
+    
+    if (f0 <= 0.0f)
+        return _numHarmonics;
+    
+    /* Largest harmonic number n with n * f0 < kHarmonicBank_MaxFrequency */
+    int n = (int)ceilf(kHarmonicBank_MaxFrequency / f0) - 1;
+    
+    if (n < 0)
+        n = 0;
+    return n < _numHarmonics ? n : _numHarmonics;
+}
+
+#pragma mark - Rendering
+/* Compute the starting phasor and per-sample rotation for each harmonic by complex multiplication with the fundamental's phasor. Only two calls to sin/cos are needed per block regardless of the number of harmonics. Double precision keeps the recursion accurate for high harmonic numbers. */
+void HarmonicOscillatorBank::initPhasors(int numHarmonics, float theta0, float thetaStep) {
+    
+    double s1 = sin((double)theta0), c1 = cos((double)theta0);
+    double ds1 = sin((double)thetaStep), dc1 = cos((double)thetaStep);
+    
+    double s = s1, c = c1;
+    double ds = ds1, dc = dc1;
+    double tmp;
+    
+    for (int n = 0; n < numHarmonics; n++) {
+        
+        _sin[n] = (float)s;
+        _cos[n] = (float)c;
+        _sinInc[n] = (float)ds;
+        _cosInc[n] = (float)dc;
+        
+        tmp = s * c1 + c * s1;
+        c = c * c1 - s * s1;
+        s = tmp;
+        
+        tmp = ds * dc1 + dc * ds1;
+        dc = dc * dc1 - ds * ds1;
+        ds = tmp;
+    }
+}
+
+void HarmonicOscillatorBank::render(float *outBuffer, int nFrames, float theta0, float thetaStep, float f0, const float *ampStart, const float *ampEnd) {
+    
+    if (nFrames > kHarmonicBank_MaxBlockSize)
+        nFrames = kHarmonicBank_MaxBlockSize;
+    
+    /* Work out the band limit once for the whole block */
+    int nActive = numBandLimitedHarmonics(f0);
+    int nGroups = (nActive + 3) >> 2;
+    
+    initPhasors(nActive, theta0, thetaStep);
+    
+    /* Amplitude ramps. The first sample uses ampStart + ampInc so the last sample lands exactly on ampEnd */
+    float invFrames = 1.0f / nFrames;
+    for (int n = 0; n < nActive; n++) {
+        _amp[n] = ampStart[n];
+        _ampInc[n] = (ampEnd[n] - ampStart[n]) * invFrames;
+    }
+    
+    /* Zero the inactive harmonics in the last group */
+    for (int n = nActive; n < (nGroups << 2); n++) {
+        _amp[n] = 0.0f;
+        _ampInc[n] = 0.0f;
+    }
+    
+#if defined(__SSE__)
+    
+    /* One four-wide accumulator per frame. Harmonics are the outer loop so each group's phasors stay in registers for the whole block */
+    __m128 acc[kHarmonicBank_MaxBlockSize];
+    for (int i = 0; i < nFrames; i++)
+        acc[i] = _mm_setzero_ps();
+    
+    for (int g = 0; g < nGroups; g++) {
+        
+        __m128 s  = _mm_loadu_ps(&_sin[g << 2]);
+        __m128 c  = _mm_loadu_ps(&_cos[g << 2]);
+        __m128 ds = _mm_loadu_ps(&_sinInc[g << 2]);
+        __m128 dc = _mm_loadu_ps(&_cosInc[g << 2]);
+        __m128 a  = _mm_loadu_ps(&_amp[g << 2]);
+        __m128 da = _mm_loadu_ps(&_ampInc[g << 2]);
+        __m128 tmp;
+        
+        for (int i = 0; i < nFrames; i++) {
+            
+            a = _mm_add_ps(a, da);
+            acc[i] = _mm_add_ps(acc[i], _mm_mul_ps(a, s));
+            
+            /* Rotate the phasors by one sample */
+            tmp = _mm_add_ps(_mm_mul_ps(s, dc), _mm_mul_ps(c, ds));
+            c = _mm_sub_ps(_mm_mul_ps(c, dc), _mm_mul_ps(s, ds));
+            s = tmp;
+        }
+    }
+    
+    /* Horizontal sum of each frame's accumulator */
+    float lanes[4];
+    for (int i = 0; i < nFrames; i++) {
+        _mm_storeu_ps(lanes, acc[i]);
+        outBuffer[i] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+    
+#else
+    
+    /* Scalar fallback using the same four-wide layout so the compiler can auto-vectorize it */
+    float acc[kHarmonicBank_MaxBlockSize][4];
+    for (int i = 0; i < nFrames; i++)
+        acc[i][0] = acc[i][1] = acc[i][2] = acc[i][3] = 0.0f;
+    
+    for (int g = 0; g < nGroups; g++) {
+        
+        float s[4], c[4], ds[4], dc[4], a[4], da[4], tmp;
+        for (int k = 0; k < 4; k++) {
+            s[k]  = _sin[(g << 2) + k];
+            c[k]  = _cos[(g << 2) + k];
+            ds[k] = _sinInc[(g << 2) + k];
+            dc[k] = _cosInc[(g << 2) + k];
+            a[k]  = _amp[(g << 2) + k];
+            da[k] = _ampInc[(g << 2) + k];
+        }
+        
+        for (int i = 0; i < nFrames; i++) {
+            for (int k = 0; k < 4; k++) {
+                
+                a[k] += da[k];
+                acc[i][k] += a[k] * s[k];
+                
+                /* Rotate the phasors by one sample */
+                tmp = s[k] * dc[k] + c[k] * ds[k];
+                c[k] = c[k] * dc[k] - s[k] * ds[k];
+                s[k] = tmp;
+            }
+        }
+    }
+    
+    for (int i = 0; i < nFrames; i++)
+        outBuffer[i] = (acc[i][0] + acc[i][1]) + (acc[i][2] + acc[i][3]);
+    
+#endif
+}
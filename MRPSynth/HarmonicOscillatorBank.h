@@ -0,0 +1,61 @@
+//
+//  HarmonicOscillatorBank.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/20/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__HarmonicOscillatorBank__
+#define __MRPSynthGUI__HarmonicOscillatorBank__
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define kHarmonicBank_MaxBlockSize 32           // Maximum number of frames per call to render()
+#define kHarmonicBank_MaxFrequency 20000.0f     // Harmonics at or above this frequency aren't rendered
+
+//! Bank of harmonically-related sinusoidal oscillators
+/*!
+    Renders the sum of harmonic sinusoids a[n] * sin((n+1) * theta) for a block of samples. Rather than calling sin() for every harmonic on every sample, each harmonic is a complex phasor that is rotated by its phase increment once per sample. Harmonics are processed four at a time in SSE registers where available.
+
+    The phasors are re-synchronized to the exact fundamental phase at the start of every call to render(), so rounding errors can't accumulate and the caller's phase accumulator remains the reference. Blocks are therefore limited to kHarmonicBank_MaxBlockSize frames; callers should update control-rate values (f0, harmonic amplitudes) between blocks.
+
+    The bank holds no audio state between calls, only preallocated scratch memory sized by setNumHarmonics(), so render() never allocates.
+*/
+class HarmonicOscillatorBank {
+    
+    int _numHarmonics;          // Number of harmonics
+    int _numPadded;             // Number of harmonics rounded up to a multiple of four
+    
+    /* Per-harmonic phasor state and amplitude ramps (scratch, length _numPadded) */
+    std::vector<float> _sin;    // sin(n * theta0)
+    std::vector<float> _cos;    // cos(n * theta0)
+    std::vector<float> _sinInc; // sin(n * thetaStep)
+    std::vector<float> _cosInc; // cos(n * thetaStep)
+    std::vector<float> _amp;    // Amplitude at the start of the block
+    std::vector<float> _ampInc; // Amplitude increment per sample
+    
+    void initPhasors(int numHarmonics, float theta0, float thetaStep);
+    
+public:
+    
+    HarmonicOscillatorBank();
+    HarmonicOscillatorBank(int numHarmonics);
+    
+    int numHarmonics() { return _numHarmonics; }
+    void setNumHarmonics(int num);
+    
+    /* Number of harmonics of f0 that lie below kHarmonicBank_MaxFrequency */
+    int numBandLimitedHarmonics(float f0);
+    
+    /* Render nFrames (at most kHarmonicBank_MaxBlockSize) samples into outBuffer, overwriting its contents. theta0 is the fundamental phase of the first sample and thetaStep the fundamental phase increment per sample. Harmonic amplitudes are ramped linearly from ampStart (exclusive) to ampEnd (reached on the last sample). Only harmonics of f0 below kHarmonicBank_MaxFrequency are rendered */
+    void render(float *outBuffer, int nFrames, float theta0, float thetaStep, float f0, const float *ampStart, const float *ampEnd);
+};
+
+#endif /* defined(__MRPSynthGUI__HarmonicOscillatorBank__) */
@@ -0,0 +1,242 @@
+//
+//  HarmonicSynthVoice.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/21/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "HarmonicSynthVoice.h"
+
+#pragma mark - Constructors
+/* Create voice with one harmonic (fundamental) */
+HarmonicSynthVoice::HarmonicSynthVoice() : _numHarmonics(1), _wavetable(nullptr), _requestAge(kHarmonicWavetable_RequestRetry) {
+    createHarmonics(std::vector<float>(1, 1.0f));
+    createWavetableParameter(0.0f);
+}
+
+/* Create voice with a specified number of harmonics */
+HarmonicSynthVoice::HarmonicSynthVoice(int numHarmonics) : _numHarmonics(numHarmonics), _wavetable(nullptr), _requestAge(kHarmonicWavetable_RequestRetry) {
+    
+    std::vector<float> amps(numHarmonics, 0.0f);
+    if (numHarmonics > 0)
+        amps[0] = 1.0f;
+    
+    createHarmonics(amps);
+    createWavetableParameter(0.0f);
+}
+
+/* Create voice with a specified number of harmonics and their amplitudes */
+HarmonicSynthVoice::HarmonicSynthVoice(std::vector<float>harmonicAmps) : _numHarmonics((int)harmonicAmps.size()), _wavetable(nullptr), _requestAge(kHarmonicWavetable_RequestRetry) {
+    createHarmonics(harmonicAmps);
+    createWavetableParameter(0.0f);
+}
+
+HarmonicSynthVoice::HarmonicSynthVoice(const HarmonicSynthVoice* master) : SynthVoice(master), _numHarmonics(master->_numHarmonics), _wavetable(nullptr), _requestAge(kHarmonicWavetable_RequestRetry) {
+    
+    _harmonicAmps.clear();
+    
+    SynthParameter* p;
+    for (int i = 0; i < _numHarmonics; i++) {
+        
+        p = new SynthParameter(*master->_harmonicAmps[i]);
+        p->setRange(0.0f, 1.0f);
+        
+        _harmonicAmps.push_back(p);             // Store harmonic amplitudes in a vector
+        addParameter(p);                        // Add to the public parameter list
+    }
+    
+    resizeOscillatorBank();
+    
+    /* Share the master's wavetables */
+    _wavetables = master->_wavetables;
+    _wavetableMode = new SynthParameter(*master->_wavetableMode);
+    _wavetableMode->setRange(0.0f, 1.0f);
+    addParameter(_wavetableMode);
+}
+
+HarmonicSynthVoice::~HarmonicSynthVoice() {
+    
+    if (_wavetable)
+        _wavetables->releaseTable(_wavetable);
+    
+    for (int i = 0; i < _harmonicAmps.size(); i++)
+        delete _harmonicAmps[i];
+    
+    if (_wavetableMode)
+        delete _wavetableMode;
+}
+
+void HarmonicSynthVoice::createWavetableParameter(float value) {
+    
+    _wavetableMode = new SynthParameter("Wavetable Oscillator", _fs, value, 0.0f);
+    _wavetableMode->setRange(0.0f, 1.0f);
+    addParameter(_wavetableMode);
+}
+
+/* Create "Harmonic N" parameters with the specified amplitudes and add them to the parameter list */
+void HarmonicSynthVoice::createHarmonics(const std::vector<float>& harmonicAmps) {
+    
+    _harmonicAmps.clear();
+    
+    SynthParameter* p;
+    for (int i = 0; i < harmonicAmps.size(); i++) {
+        
+        char name[12];
+        sprintf(name, "Harmonic %d", i+1);
+        p = new SynthParameter(name, _fs, harmonicAmps[i], 0.1f);
+        p->setRange(0.0f, 1.0f);
+        
+        _harmonicAmps.push_back(p);             // Store harmonic amplitudes in a vector
+        addParameter(p);                        // Add to the public parameter list
+    }
+    
+    resizeOscillatorBank();
+    
+    /* Any existing wavetables were built for the old harmonics. Instance voices cloned earlier keep their reference to the old cache */
+    bool buildInline = _wavetables && _wavetables->buildsInline();
+    if (_wavetable)
+        _wavetables->releaseTable(_wavetable);
+    _wavetables.reset(new HarmonicWavetableCache((int)_harmonicAmps.size()));
+    _wavetables->setBuildsInline(buildInline);
+    _wavetable = nullptr;
+    _requestAge = kHarmonicWavetable_RequestRetry;
+}
+
+void HarmonicSynthVoice::resizeOscillatorBank() {
+    
+    /* Size the oscillator bank and its amplitude buffers here so renderHarmonics() never allocates */
+    _oscBank.setNumHarmonics((int)_harmonicAmps.size());
+    _ampStart.resize(_harmonicAmps.size());
+    _ampEnd.resize(_harmonicAmps.size());
+    _requestedAmps.resize(_harmonicAmps.size());
+}
+
+#pragma mark - Setters
+void HarmonicSynthVoice::setNumHarmonics(float num) {
+    
+    for (int i = 0; i < _numHarmonics; i++) {
+        
+        char name[12];
+        sprintf(name, "Harmonic %d", i+1);
+        removeParameter(name);
+    }
+    
+    for (int i = 0; i < _harmonicAmps.size(); i++)
+        delete _harmonicAmps[i];
+    
+    _numHarmonics = num;
+    
+    std::vector<float> amps(_numHarmonics, 0.0f);
+    if (_numHarmonics > 0)
+        amps[0] = 1.0f;
+    
+    createHarmonics(amps);
+    commitParameters();
+}
+
+void HarmonicSynthVoice::setHarmonicAmp(int harmonicNumber, float amp) {
+    
+    if (harmonicNumber >= 1 && harmonicNumber <= _numHarmonics)
+        _harmonicAmps[harmonicNumber-1]->setValue(amp);
+}
+
+#pragma mark - Rendering
+float HarmonicSynthVoice::harmonicSample() {
+    
+    float sample = 0.0f;
+    
+    /* Add a value for each harmonic below 20kHz. Harmonic amplitudes are ramped with the rest of the parameter list in sampleUpdate() */
+    for (int n = 0; n < _numHarmonics; n++) {
+        if (_f0->value() * (n+1) < kHarmonicBank_MaxFrequency)
+            sample += (_harmonicAmps[n]->value() * sin((n+1) * _theta));
+    }
+    
+    return sample / _numHarmonics;     // Normalize
+}
+
+int HarmonicSynthVoice::renderHarmonics(float *outBuffer, int nFrames) {
+    
+    int cont = 1;
+    int n = std::min(nFrames, kHarmonicBank_MaxBlockSize);
+    int nHarmonics = (int)_harmonicAmps.size();
+    float gain[kHarmonicBank_MaxBlockSize];
+    
+    float f0 = _f0->value();
+    float amp = _amp->value();
+    for (int h = 0; h < nHarmonics; h++)
+        _ampStart[h] = _harmonicAmps[h]->value();
+    
+    /* Ramp the parameter list (including harmonic amplitudes) once for the whole sub-block. The oscillator bank ramps the harmonic amplitudes across it, and f0 and the voice amplitude are interpolated per sample below */
+    controlUpdate(n);
+    
+    float f0Step = (_f0->value() - f0) / n;
+    float ampStep = (_amp->value() - amp) / n;
+    float f0Max = std::max(f0, _f0->value());
+    for (int h = 0; h < nHarmonics; h++)
+        _ampEnd[h] = _harmonicAmps[h]->value();
+    
+    float theta0 = 0.0f;        // Phase of the first sample in the sub-block
+    float thetaAdvance = 0.0f;  // Unwrapped phase advance over the sub-block
+    
+    /* Envelope amplitudes for the whole sub-block. Gains after the end of the release are zero */
+    cont = _adsr.update(gain, n);
+    float velAmp = _velAmp->value() / _numHarmonics;
+    
+    /* Update the phase and gains first, then render all harmonics for the sub-block at once */
+    for (int j = 0; j < n; j++) {
+        
+        f0 += f0Step;
+        amp += ampStep;
+        phaseUpdate(f0);
+        
+        if (j == 0)
+            theta0 = _theta;
+        else
+            thetaAdvance += _thetaStep;
+        
+        gain[j] *= velAmp * amp;
+    }
+    
+    /* Use the mean phase increment over the sub-block. The oscillators re-synchronize to the exact phase on the next sub-block */
+    float thetaStep = n > 1 ? thetaAdvance / (n - 1) : _thetaStep;
+    
+    /* Wavetable playback when enabled and the harmonic amplitudes are steady. Look up a new table set only when the amplitudes differ from the current one's */
+    bool useWavetable = _wavetableMode->value() >= 0.5f && _wavetables && std::equal(_ampStart.begin(), _ampStart.end(), _ampEnd.begin());
+    
+    if (useWavetable && (!_wavetable || !_wavetable->matches(_ampEnd.data()))) {
+        
+        if (_wavetable)
+            _wavetables->releaseTable(_wavetable);
+        _wavetable = _wavetables->acquireTable(_ampEnd.data());
+        
+        /* Ask for a table once per set of amplitudes, and again if it still hasn't turned up after a while. A request that didn't fit is retried on the next sub-block. Inline builds are ready as soon as requestTable() returns */
+        if (!_wavetable && (++_requestAge >= kHarmonicWavetable_RequestRetry || !std::equal(_ampEnd.begin(), _ampEnd.end(), _requestedAmps.begin()))) {
+            
+            std::copy(_ampEnd.begin(), _ampEnd.end(), _requestedAmps.begin());
+            
+            if (_wavetables->requestTable(_ampEnd.data())) {
+                _requestAge = 0;
+                _wavetable = _wavetables->acquireTable(_ampEnd.data());
+            }
+            else
+                _requestAge = kHarmonicWavetable_RequestRetry;
+        }
+    }
+    
+    if (useWavetable && _wavetable)
+        _wavetable->render(outBuffer, n, theta0, thetaStep, f0Max);
+    
+    /* Otherwise (or until the table for these amplitudes is built) render the harmonics with the oscillator bank */
+    else
+        _oscBank.render(outBuffer, n, theta0, thetaStep, f0Max, _ampStart.data(), _ampEnd.data());
+    
+    for (int j = 0; j < n; j++)
+        outBuffer[j] *= gain[j];
+    
+    /* Zero anything left over after the note ended */
+    for (int j = n; j < nFrames; j++)
+        outBuffer[j] = 0.0f;
+    
+    return cont;
+}
@@ -0,0 +1,76 @@
+//
+//  HarmonicSynthVoice.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/21/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__HarmonicSynthVoice__
+#define __MRPSynthGUI__HarmonicSynthVoice__
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+#include "SynthVoice.h"
+#include "HarmonicOscillatorBank.h"
+#include "HarmonicWavetable.h"
+
+//! Base class for synth voices built from a sum of harmonics
+/*!
+    Owns the "Harmonic N" amplitude parameters and the HarmonicOscillatorBank that renders them, so AdditiveSynthVoice and SubtractiveSynthVoice share one harmonic generator.
+
+    Setting the "Wavetable Oscillator" parameter to 1 switches the block renderer to band-limited wavetable playback, which costs one interpolated lookup per sample regardless of the number of harmonics. Wavetables are shared between a master voice and the instance voices cloned from it, and are only requested once the harmonic amplitudes settle on new values. They're built by the HarmonicWavetableCache's own thread, never by the render path. While the amplitudes are ramping, or until a table for them is ready, the oscillator bank is used instead.
+
+    Subclasses render blocks by calling renderHarmonics() for sub-blocks of at most kHarmonicBank_MaxBlockSize frames and then applying any per-block processing (e.g. filtering) to the result. harmonicSample() is the equivalent single-sample path used by renderSample().
+*/
+class HarmonicSynthVoice : public SynthVoice {
+    
+protected:
+    
+    int _numHarmonics;                              // Number of harmonics
+    std::vector<SynthParameter*> _harmonicAmps;     // Harmonic amplitudes
+    
+    HarmonicOscillatorBank _oscBank;                // Block renderer for the harmonics
+    std::vector<float> _ampStart;                   // Harmonic amplitudes at the start/end of each oscillator bank block
+    std::vector<float> _ampEnd;
+    
+    SynthParameter *_wavetableMode;                             // Use wavetable playback when >= 0.5
+    std::shared_ptr<HarmonicWavetableCache> _wavetables;        // Wavetables shared with the master/instance voices
+    HarmonicWavetable *_wavetable;                              // Table set for the current harmonic amplitudes
+    std::vector<float> _requestedAmps;                          // Amplitudes of the last table request
+    int _requestAge;                                            // Sub-blocks since the last table request
+    
+    void createWavetableParameter(float value);
+    void createHarmonics(const std::vector<float>& harmonicAmps);
+    void resizeOscillatorBank();
+    
+    /* Sum of the harmonics below 20kHz at the current phase, normalized by the number of harmonics. Call after sampleUpdate() */
+    float harmonicSample();
+    
+    /* Render nFrames (at most kHarmonicBank_MaxBlockSize) samples of the harmonics scaled by the velocity, envelope, and voice amplitudes, ramping the parameter list once for the sub-block (see SynthVoice::controlUpdate()) and updating the phase and ADSR envelope for each sample. Returns 0 if the envelope finished releasing, in which case the remaining samples are zero */
+    int renderHarmonics(float *outBuffer, int nFrames);
+    
+public:
+    
+    HarmonicSynthVoice();
+    HarmonicSynthVoice(int numHarmonics);
+    HarmonicSynthVoice(std::vector<float>harmonicAmps);
+    HarmonicSynthVoice(const HarmonicSynthVoice *master);
+    ~HarmonicSynthVoice();
+    
+    SynthVoice* clone(void *mem) const { return new (mem) HarmonicSynthVoice(this); }
+    size_t cloneSize() const { return sizeof(HarmonicSynthVoice); }
+    
+    int numHarmonics() { return _numHarmonics; }
+    
+    void setNumHarmonics(float num);
+    void setHarmonicAmp(int harmonicNumber, float amp);
+    
+    /* Build wavetables inline while rendering offline. Affects the master voice and every instance voice sharing its tables */
+    void setOfflineRendering(bool offline) { if (_wavetables) _wavetables->setBuildsInline(offline); }
+};
+
+#endif /* defined(__MRPSynthGUI__HarmonicSynthVoice__) */
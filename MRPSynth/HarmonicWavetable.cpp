@@ -0,0 +1,250 @@
+//
+//  HarmonicWavetable.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/22/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "HarmonicWavetable.h"
+
+#pragma mark - HarmonicWavetable
+HarmonicWavetable::HarmonicWavetable() : _numHarmonics(0), _state(0), _lastUsed(0) { }
+
+/* One cycle of a sine wave shared by all tables, computed on first use. A plain array, so it isn't destroyed at exit while builder threads of caches that are never deleted may still be using it */
+const float* HarmonicWavetable::sineTable() {
+    
+    static float table[kHarmonicWavetable_Size];
+    static bool isComputed = false;
+    
+    if (!isComputed) {
+        for (int i = 0; i < kHarmonicWavetable_Size; i++)
+            table[i] = (float)sin(2.0 * M_PI * i / kHarmonicWavetable_Size);
+        isComputed = true;
+    }
+    
+    return table;
+}
+
+void HarmonicWavetable::setNumHarmonics(int num) {
+    
+    _numHarmonics = num < 0 ? 0 : num;
+    _amps.assign(_numHarmonics, 0.0f);
+    _tables.assign(_numHarmonics * (kHarmonicWavetable_Size + 1), 0.0f);
+    _state = 0;
+    
+    sineTable();    // Make sure the sine table exists before rendering starts
+}
+
+void HarmonicWavetable::build(const float *amps) {
+    
+    const float *sine = sineTable();
+    const int stride = kHarmonicWavetable_Size + 1;
+    
+    for (int h = 0; h < _numHarmonics; h++) {
+        
+        float *table = &_tables[h * stride];
+        float a = amps[h];
+        
+        /* Level h is level h-1 plus harmonic h+1 */
+        if (h == 0) {
+            for (int i = 0; i < kHarmonicWavetable_Size; i++)
+                table[i] = a * sine[i];
+        }
+        else {
+            const float *prev = table - stride;
+            for (int i = 0; i < kHarmonicWavetable_Size; i++)
+                table[i] = prev[i] + a * sine[(i * (h+1)) & (kHarmonicWavetable_Size - 1)];
+        }
+        
+        table[kHarmonicWavetable_Size] = table[0];  // Guard sample for interpolation
+        _amps[h] = a;
+    }
+}
+
+void HarmonicWavetable::render(float *outBuffer, int nFrames, float theta0, float thetaStep, float f0) {
+    
+    /* Choose the level containing only harmonics below the band limit */
+    int level = _numHarmonics;
+    if (f0 > 0.0f) {
+        int maxHarmonic = (int)ceilf(kHarmonicBank_MaxFrequency / f0) - 1;
+        if (maxHarmonic < level)
+            level = maxHarmonic;
+    }
+    
+    if (level <= 0) {
+        for (int i = 0; i < nFrames; i++)
+            outBuffer[i] = 0.0f;
+        return;
+    }
+    
+    const float *table = &_tables[(level - 1) * (kHarmonicWavetable_Size + 1)];
+    const float radToIdx = kHarmonicWavetable_Size / (2.0f * (float)M_PI);
+    
+    /* Table position and increment in samples */
+    float pos = fmodf(theta0 * radToIdx, (float)kHarmonicWavetable_Size);
+    if (pos < 0.0f)
+        pos += kHarmonicWavetable_Size;
+    if (pos >= kHarmonicWavetable_Size)
+        pos -= kHarmonicWavetable_Size;
+    float inc = thetaStep * radToIdx;
+    
+    for (int i = 0; i < nFrames; i++) {
+        
+        int idx = (int)pos;
+        float frac = pos - idx;
+        outBuffer[i] = table[idx] + frac * (table[idx + 1] - table[idx]);
+        
+        pos += inc;
+        if (pos >= kHarmonicWavetable_Size)
+            pos -= kHarmonicWavetable_Size;
+    }
+}
+
+#pragma mark - HarmonicWavetableCache
+HarmonicWavetableCache::HarmonicWavetableCache(int numHarmonics) : _numHarmonics(numHarmonics < 0 ? 0 : numHarmonics), _useCount(0), _nPending(0), _buildInline(false), _quit(false) {
+    
+    for (int i = 0; i < kHarmonicWavetable_NumCacheSlots; i++)
+        _slots[i].setNumHarmonics(_numHarmonics);
+    
+    for (int i = 0; i < kHarmonicWavetable_NumRequests; i++) {
+        _requests[i].state = kRequest_Free;
+        _requests[i].amps.assign(_numHarmonics, 0.0f);
+    }
+    
+    _thread = std::thread(&HarmonicWavetableCache::buildLoop, this);
+}
+
+HarmonicWavetableCache::~HarmonicWavetableCache() {
+    
+    _quit = true;
+    _wake.signal();
+    _thread.join();
+}
+
+HarmonicWavetable* HarmonicWavetableCache::acquireTable(const float *amps) {
+    
+    for (int i = 0; i < kHarmonicWavetable_NumCacheSlots; i++) {
+    
+        HarmonicWavetable *table = &_slots[i];
+    
+        if (!(table->_state.load(std::memory_order_acquire) & kHarmonicWavetable_Published))
+            continue;
+        
+        /* Hold the table while comparing its amplitudes so the builder can't reclaim it in the meantime */
+        int state = table->_state.fetch_add(1, std::memory_order_acq_rel);
+        
+        if ((state & kHarmonicWavetable_Published) && table->matches(amps)) {
+            table->_lastUsed.store(++_useCount, std::memory_order_relaxed);
+            return table;
+        }
+        
+        table->_state.fetch_sub(1, std::memory_order_release);
+    }
+    
+    return nullptr;
+}
+
+void HarmonicWavetableCache::releaseTable(HarmonicWavetable *table) {
+    
+    int state = table->_state.fetch_sub(1, std::memory_order_release);
+    
+    /* Requests that found every table held can use this one now */
+    if ((state & ~kHarmonicWavetable_Published) == 1 && _nPending.load(std::memory_order_relaxed) > 0)
+        _wake.signal();
+}
+
+bool HarmonicWavetableCache::requestTable(const float *amps) {
+    
+    for (int i = 0; i < kHarmonicWavetable_NumRequests; i++) {
+        
+        Request& request = _requests[i];
+        int expected = kRequest_Free;
+        
+        if (!request.state.compare_exchange_strong(expected, kRequest_Writing, std::memory_order_acquire))
+            continue;
+        
+        std::copy(amps, amps + _numHarmonics, request.amps.begin());
+        _nPending++;
+        request.state.store(kRequest_Ready, std::memory_order_release);
+        
+        if (_buildInline) {
+            std::lock_guard<std::mutex> lock(_buildLock);
+            buildPending();
+        }
+        else
+            _wake.signal();
+        
+        return true;
+    }
+    
+    return false;
+}
+
+void HarmonicWavetableCache::buildLoop() {
+    
+    while (!_quit) {
+        
+        _wake.wait();
+        
+        std::lock_guard<std::mutex> lock(_buildLock);
+        buildPending();
+    }
+}
+
+void HarmonicWavetableCache::buildPending() {
+    
+    for (int i = 0; i < kHarmonicWavetable_NumRequests; i++) {
+        
+        Request& request = _requests[i];
+        
+        if (request.state.load(std::memory_order_acquire) != kRequest_Ready)
+            continue;
+        
+        /* Several voices may have asked for the same amplitudes. Only this thread writes the tables, so published ones can be compared without holding them */
+        bool built = false;
+        for (int j = 0; j < kHarmonicWavetable_NumCacheSlots && !built; j++)
+            built = (_slots[j]._state.load(std::memory_order_acquire) & kHarmonicWavetable_Published) && _slots[j].matches(request.amps.data());
+        
+        if (!built) {
+            
+            /* Leave the request pending if every table is held. releaseTable() wakes us when one is free */
+            HarmonicWavetable *table = reclaimTable();
+            if (!table)
+                continue;
+            
+            table->build(request.amps.data());
+            table->_lastUsed.store(++_useCount, std::memory_order_relaxed);
+            table->_state.fetch_or(kHarmonicWavetable_Published, std::memory_order_release);
+        }
+        
+        _nPending--;
+        request.state.store(kRequest_Free, std::memory_order_release);
+    }
+}
+
+HarmonicWavetable* HarmonicWavetableCache::reclaimTable() {
+    
+    for (;;) {
+        
+        int lru = -1;
+        int lruState = 0;
+        
+        for (int i = 0; i < kHarmonicWavetable_NumCacheSlots; i++) {
+            
+            int state = _slots[i]._state.load(std::memory_order_acquire);
+            
+            if ((state & ~kHarmonicWavetable_Published) == 0 && (lru < 0 || _slots[i]._lastUsed < _slots[lru]._lastUsed)) {
+                lru = i;
+                lruState = state;
+            }
+        }
+        
+        if (lru < 0)
+            return nullptr;
+        
+        /* Unpublish it unless a voice took hold of it since the scan. Voices don't read unpublished tables, so it can be rebuilt */
+        if (_slots[lru]._state.compare_exchange_strong(lruState, 0, std::memory_order_acq_rel))
+            return &_slots[lru];
+    }
+}
@@ -0,0 +1,122 @@
+//
+//  HarmonicWavetable.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/22/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__HarmonicWavetable__
+#define __MRPSynthGUI__HarmonicWavetable__
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+#include "HarmonicOscillatorBank.h"
+#include "Semaphore.h"
+
+#define kHarmonicWavetable_Size 2048            // Samples per table (power of two)
+#define kHarmonicWavetable_NumCacheSlots 4      // Amplitude snapshots kept by a HarmonicWavetableCache
+#define kHarmonicWavetable_NumRequests 16       // Build requests a HarmonicWavetableCache can have pending
+#define kHarmonicWavetable_RequestRetry 64      // Sub-blocks a voice waits for a requested table before asking again (in case it was reclaimed before the voice found it)
+#define kHarmonicWavetable_Published 0x40000000 // Flag in a table's state word. The rest of the word counts the voices holding it
+
+//! Band-limited wavetable for one set of harmonic amplitudes
+/*!
+    Holds one single-cycle table per band-limit level, where level h contains harmonics 1 through h. At render time the level is chosen from f0 so that no harmonic reaches kHarmonicBank_MaxFrequency, and each output sample is a single linearly-interpolated table lookup regardless of the number of harmonics.
+
+    Tables are built cumulatively (level h = level h-1 plus harmonic h) from a shared sine table, so a rebuild costs one multiply-add per table sample per harmonic and no calls to sin().
+*/
+class HarmonicWavetable {
+    
+    int _numHarmonics;              // Number of harmonics (and table levels)
+    std::vector<float> _amps;       // Amplitude snapshot the tables were built from
+    std::vector<float> _tables;     // _numHarmonics tables of kHarmonicWavetable_Size + 1 samples (with wrap-around guard sample)
+    std::atomic<int> _state;        // kHarmonicWavetable_Published once built, plus the number of voices holding it (see HarmonicWavetableCache)
+    std::atomic<unsigned long> _lastUsed;   // Cache bookkeeping
+    
+    static const float* sineTable();
+    
+    HarmonicWavetable(const HarmonicWavetable&);
+    HarmonicWavetable& operator=(const HarmonicWavetable&);
+    
+    friend class HarmonicWavetableCache;
+    
+public:
+    
+    HarmonicWavetable();
+    
+    void setNumHarmonics(int num);
+    int numHarmonics() { return _numHarmonics; }
+    
+    /* Rebuild the tables from numHarmonics amplitudes */
+    void build(const float *amps);
+    
+    /* Whether the tables were built from these amplitudes */
+    bool matches(const float *amps) { return std::equal(_amps.begin(), _amps.end(), amps); }
+    
+    /* Render nFrames samples into outBuffer, overwriting its contents. theta0 is the fundamental phase of the first sample and thetaStep the phase increment per sample. The table level is chosen for f0 */
+    void render(float *outBuffer, int nFrames, float theta0, float thetaStep, float f0);
+};
+
+//! Small set of HarmonicWavetables shared by a master voice and its instance voices, built on a thread of its own
+/*!
+    Voices playing with the same harmonic amplitudes share one table set. A voice looks for a table with acquireTable(), which never blocks, allocates or builds: it only checks the published tables, holding one by incrementing its state word. When none matches, the voice posts the amplitudes with requestTable() and renders with its oscillator bank until the table is published. The builder thread takes the least recently used table no voice is holding, rebuilds it, and publishes it by setting kHarmonicWavetable_Published in its state word. A held table is never rebuilt, so it stays valid until the voice calls releaseTable().
+
+    Table and request memory is allocated by the constructor. Requests that find every table held wait until a voice releases one. With setBuildsInline(), requestTable() builds on the calling thread instead, which keeps offline renders independent of the builder thread's timing.
+*/
+class HarmonicWavetableCache {
+    
+    enum {
+        kRequest_Free = 0,
+        kRequest_Writing,       // Amplitudes being copied in by requestTable()
+        kRequest_Ready          // Waiting for the builder
+    };
+    
+    struct Request {
+        std::atomic<int> state;
+        std::vector<float> amps;
+    };
+    
+    int _numHarmonics;
+    HarmonicWavetable _slots[kHarmonicWavetable_NumCacheSlots];
+    Request _requests[kHarmonicWavetable_NumRequests];
+    std::atomic<unsigned long> _useCount;
+    std::atomic<int> _nPending;             // Ready requests
+    std::atomic<bool> _buildInline;
+    
+    std::mutex _buildLock;                  // Held while building, by the builder thread or a thread building inline. Never taken by acquireTable() or releaseTable()
+    Semaphore _wake;                        // Signalled by requestTable(), and by releaseTable() while requests wait for a free table
+    std::thread _thread;
+    std::atomic<bool> _quit;
+    
+    HarmonicWavetableCache(const HarmonicWavetableCache&);
+    HarmonicWavetableCache& operator=(const HarmonicWavetableCache&);
+    
+    void buildLoop();
+    void buildPending();                    // Build a table for each ready request that doesn't have one yet. Caller holds _buildLock
+    HarmonicWavetable* reclaimTable();      // Unpublish the least recently used table no voice is holding. Returns nullptr if they're all held
+    
+public:
+    
+    HarmonicWavetableCache(int numHarmonics);
+    ~HarmonicWavetableCache();
+    
+    /* Return the published table built from the specified amplitudes and hold it until releaseTable(), or nullptr if there isn't one. Real-time safe */
+    HarmonicWavetable* acquireTable(const float *amps);
+    void releaseTable(HarmonicWavetable *table);
+    
+    /* Ask for a table to be built from the specified amplitudes. Real-time safe unless building inline. Returns false if too many requests are pending */
+    bool requestTable(const float *amps);
+    
+    /* Build requested tables on the requesting thread instead of the builder thread (e.g. while rendering offline). Not real-time safe */
+    void setBuildsInline(bool buildInline) { _buildInline = buildInline; }
+    bool buildsInline() { return _buildInline; }
+};
+
+#endif /* defined(__MRPSynthGUI__HarmonicWavetable__) */
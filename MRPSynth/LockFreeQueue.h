@@ -0,0 +1,147 @@
+//
+//  LockFreeQueue.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/24/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__LockFreeQueue__
+#define __MRPSynthGUI__LockFreeQueue__
+
+#include <atomic>
+
+//! Fixed-size single-producer, single-consumer FIFO
+/*!
+    Passes items of type T between two threads (e.g. MIDI input to audio render) without locks or allocation. push() and pop() are both wait-free as long as there's only one producer thread and one consumer thread at a time. Callers with several producer threads have to serialize their calls to push().
+
+    Size must be a power of two. The queue holds at most Size items; push() fails rather than blocking when it's full.
+*/
+template <typename T, unsigned int Size>
+class LockFreeQueue {
+    
+    static_assert((Size & (Size - 1)) == 0, "LockFreeQueue size must be a power of two");
+    
+    T _items[Size];
+    std::atomic<unsigned int> _writeIdx;        // Total number of items pushed (written by the producer only)
+    std::atomic<unsigned int> _readIdx;         // Total number of items popped (written by the consumer only)
+    
+public:
+    
+    LockFreeQueue() : _writeIdx(0), _readIdx(0) { }
+    
+    /* Producer: add an item to the back of the queue. Returns false if the queue is full */
+    bool push(const T& item) {
+        
+        unsigned int w = _writeIdx.load(std::memory_order_relaxed);
+        
+        if (w - _readIdx.load(std::memory_order_acquire) >= Size)
+            return false;
+        
+        _items[w & (Size - 1)] = item;
+        _writeIdx.store(w + 1, std::memory_order_release);     // Publish the item to the consumer
+        return true;
+    }
+    
+    /* Consumer: copy the item at the front of the queue without removing it. Returns false if the queue is empty */
+    bool peek(T *item) {
+        
+        unsigned int r = _readIdx.load(std::memory_order_relaxed);
+        
+        if (r == _writeIdx.load(std::memory_order_acquire))
+            return false;
+        
+        *item = _items[r & (Size - 1)];
+        return true;
+    }
+    
+    /* Consumer: remove the item at the front of the queue. Returns false if the queue is empty */
+    bool pop(T *item) {
+        
+        unsigned int r = _readIdx.load(std::memory_order_relaxed);
+        
+        if (r == _writeIdx.load(std::memory_order_acquire))
+            return false;
+        
+        *item = _items[r & (Size - 1)];
+        _readIdx.store(r + 1, std::memory_order_release);      // Free the slot for the producer
+        return true;
+    }
+    
+    bool isEmpty() {
+        return _readIdx.load(std::memory_order_acquire) == _writeIdx.load(std::memory_order_acquire);
+    }
+};
+
+//! Fixed-size multiple-producer, single-consumer FIFO
+/*!
+    Like LockFreeQueue, but any number of threads can push() at once without serializing their calls. Each slot carries a sequence number saying whether it's free for the push at a given position or holds the item pushed there. A producer claims a position with a compare-and-swap and then fills its slot, so producers never wait on each other: one preempted while copying its item only delays the consumer, which stops at that slot until it's published.
+
+    Size must be a power of two. push() fails rather than blocking when the queue is full.
+*/
+template <typename T, unsigned int Size>
+class MultiProducerQueue {
+    
+    static_assert((Size & (Size - 1)) == 0, "MultiProducerQueue size must be a power of two");
+    
+    struct Slot {
+        std::atomic<unsigned int> sequence;     // Position the slot is free for, or that position + 1 once its item is published
+        T item;
+    };
+    
+    Slot _slots[Size];
+    std::atomic<unsigned int> _writeIdx;        // Next position to claim (shared by the producers)
+    unsigned int _readIdx;                      // Next position to pop (consumer only)
+    
+public:
+    
+    MultiProducerQueue() : _writeIdx(0), _readIdx(0) {
+        for (unsigned int i = 0; i < Size; i++)
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    
+    /* Producer (any thread): add an item to the back of the queue. Returns false if the queue is full */
+    bool push(const T& item) {
+        
+        unsigned int w = _writeIdx.load(std::memory_order_relaxed);
+        
+        while (true) {
+            
+            Slot& slot = _slots[w & (Size - 1)];
+            int diff = (int)(slot.sequence.load(std::memory_order_acquire) - w);
+            
+            /* The slot is free for position w. Claim it, or retry at the position another producer moved on to */
+            if (diff == 0) {
+                if (_writeIdx.compare_exchange_weak(w, w + 1, std::memory_order_relaxed)) {
+                    slot.item = item;
+                    slot.sequence.store(w + 1, std::memory_order_release);     // Publish the item to the consumer
+                    return true;
+                }
+            }
+            
+            /* The slot still holds the item from one lap ago */
+            else if (diff < 0)
+                return false;
+            
+            /* Another producer has claimed position w */
+            else
+                w = _writeIdx.load(std::memory_order_relaxed);
+        }
+    }
+    
+    /* Consumer: remove the item at the front of the queue. Returns false if the queue is empty, or the item at the front is still being written */
+    bool pop(T *item) {
+        
+        Slot& slot = _slots[_readIdx & (Size - 1)];
+        
+        if (slot.sequence.load(std::memory_order_acquire) != _readIdx + 1)
+            return false;
+        
+        *item = slot.item;
+        slot.sequence.store(_readIdx + Size, std::memory_order_release);  // Free the slot for the push one lap ahead
+        _readIdx++;
+        return true;
+    }
+};
+
+#endif /* defined(__MRPSynthGUI__LockFreeQueue__) */
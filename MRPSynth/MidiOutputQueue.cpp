@@ -0,0 +1,195 @@
+//
+//  MidiOutputQueue.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/30/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "MidiOutputQueue.h"
+
+MidiOutputQueue::MidiOutputQueue(RtMidiOut *output) : _output(output), _nDropped(0), _pending(false), _stamp(0), _quit(false) {
+    
+    for (int i = 0; i < kMidiOutputQueue_NumSlots; i++)
+        _slotStamps[i] = 0;
+    for (int i = 0; i < kMidiOutputQueue_NumChannels; i++)
+        _channelStamps[i] = 0;
+    
+    _buffer.reserve(3);
+    _thread = std::thread(&MidiOutputQueue::flushLoop, this);
+}
+
+MidiOutputQueue::~MidiOutputQueue() {
+    
+    _quit = true;
+    _wake.signal();
+    _thread.join();
+}
+
+void MidiOutputQueue::setOutput(RtMidiOut *output) {
+    
+    std::lock_guard<std::mutex> lock(_outputLock);
+    flushLocked();
+    _output = output;
+}
+
+bool MidiOutputQueue::queueMessage(const unsigned char *bytes, int size) {
+    
+    if (size < 1 || size > 3 || !(bytes[0] & 0x80))
+        return false;
+    
+    Message message;
+    message.size = size;
+    for (int i = 0; i < size; i++)
+        message.bytes[i] = bytes[i];
+    
+    bool queued = _queue.push(message);
+    
+    if (!queued)
+        _nDropped++;
+    
+    /* Wake the flush thread for the first message since its last flush. Later messages in the batch only cost the exchange */
+    if (!_pending.exchange(true, std::memory_order_acq_rel))
+        _wake.signal();
+    
+    return queued;
+}
+
+bool MidiOutputQueue::sendMessage(const unsigned char *bytes, int size) {
+    
+    if (size < 1)
+        return false;
+    
+    std::lock_guard<std::mutex> lock(_outputLock);
+    flushLocked();
+    return send(bytes, size);
+}
+
+void MidiOutputQueue::flush() {
+    
+    std::lock_guard<std::mutex> lock(_outputLock);
+    flushLocked();
+}
+
+void MidiOutputQueue::flushLoop() {
+    
+    while (!_quit) {
+        
+        _wake.wait();
+        
+        /* Give the rest of the batch a moment to arrive so redundant updates can be coalesced. Clearing _pending before popping means a message pushed after the last pop wakes us again */
+        std::this_thread::sleep_for(std::chrono::duration<double>(kMidiOutputQueue_FlushInterval));
+        _pending.exchange(false, std::memory_order_acq_rel);
+        flush();
+    }
+    
+    /* Send anything queued while we were shutting down */
+    flush();
+}
+
+void MidiOutputQueue::flushLocked() {
+    
+    int nMessages = 0;
+    while (nMessages < kMidiOutputQueue_Size && _queue.pop(&_batch[nMessages]))
+        nMessages++;
+    
+    unsigned int nDropped = _nDropped.exchange(0);
+    if (nDropped > 0)
+        printf("%s: MIDI output queue full. Dropped %u messages\n", __PRETTY_FUNCTION__, nDropped);
+    
+    if (nMessages == 0 || _output == NULL)
+        return;
+    
+    coalesce(nMessages);
+    
+    for (int i = 0; i < nMessages; i++) {
+        if (_keep[i])
+            send(_batch[i].bytes, _batch[i].size);
+    }
+}
+
+/* Scan the batch backwards, keeping only the last update of each slot in every run of messages between two non-coalescable messages on its channel */
+void MidiOutputQueue::coalesce(int nMessages) {
+    
+    /* Start a new segment on every channel so stamps left from the previous batch never match */
+    for (int ch = 0; ch < kMidiOutputQueue_NumChannels; ch++)
+        _channelStamps[ch] = ++_stamp;
+    
+    for (int i = nMessages-1; i >= 0; i--) {
+        
+        const Message& message = _batch[i];
+        int slot = slotForMessage(message);
+        
+        if (slot < 0) {
+            
+            /* Close the segment on this message's channel, or on every channel for system messages */
+            if (message.bytes[0] < 0xF0)
+                _channelStamps[message.bytes[0] & 0x0F] = ++_stamp;
+            else {
+                for (int ch = 0; ch < kMidiOutputQueue_NumChannels; ch++)
+                    _channelStamps[ch] = ++_stamp;
+            }
+            _keep[i] = true;
+            continue;
+        }
+        
+        unsigned int channelStamp = _channelStamps[message.bytes[0] & 0x0F];
+        _keep[i] = _slotStamps[slot] != channelStamp;
+        _slotStamps[slot] = channelStamp;
+    }
+}
+
+int MidiOutputQueue::slotForMessage(const Message& message) {
+    
+    int channel = message.bytes[0] & 0x0F;
+    
+    switch (message.bytes[0] & 0xF0) {
+        
+        case 0xB0:      // Control change
+            
+            if (message.size < 3)
+                return -1;
+            
+            /* Data entry (6, 38), increment/decrement (96, 97), NRPN/RPN selection (98-101) and channel mode messages (120-127) */
+            if (message.bytes[1] == 6 || message.bytes[1] == 38 || (message.bytes[1] >= 96 && message.bytes[1] <= 101) || message.bytes[1] >= 120)
+                return -1;
+            
+            return channel * 128 + (message.bytes[1] & 0x7F);
+        
+        case 0xA0:      // Poly aftertouch
+            
+            if (message.size < 3)
+                return -1;
+            
+            return kMidiOutputQueue_NumChannels * 128 + channel * 128 + (message.bytes[1] & 0x7F);
+        
+        case 0xD0:      // Channel aftertouch
+            return kMidiOutputQueue_NumChannels * 256 + channel;
+        
+        case 0xE0:      // Pitch bend
+            return kMidiOutputQueue_NumChannels * 257 + channel;
+        
+        default:
+            return -1;
+    }
+}
+
+bool MidiOutputQueue::send(const unsigned char *bytes, int size) {
+    
+    if (_output == NULL)
+        return false;
+    
+    _buffer.assign(bytes, bytes + size);
+    
+    try {
+        _output->sendMessage(&_buffer);
+    }
+    catch (RtMidiError& err) {
+        printf("%s: Error sending MIDI message. RtMidiError: ", __PRETTY_FUNCTION__);
+        err.printMessage();
+        printf("\n");
+        return false;
+    }
+    
+    return true;
+}
@@ -0,0 +1,88 @@
+//
+//  MidiOutputQueue.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/30/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__MidiOutputQueue__
+#define __MRPSynthGUI__MidiOutputQueue__
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+
+#include "RtMidi.h"
+#include "LockFreeQueue.h"
+#include "Semaphore.h"
+
+#define kMidiOutputQueue_Size 4096              // Maximum number of pending messages (power of two). Covers tens of milliseconds of dense controller streams if the flush thread is held up
+#define kMidiOutputQueue_FlushInterval 0.001    // Seconds the flush thread waits after the first message of a batch. Redundant updates within it are coalesced
+#define kMidiOutputQueue_NumChannels 16
+#define kMidiOutputQueue_NumSlots (kMidiOutputQueue_NumChannels * 128 * 2 + kMidiOutputQueue_NumChannels * 2)  // Controllers, poly aftertouch, channel aftertouch, pitch bend
+
+//! Batched, coalescing MIDI output shared by the MIDI, UI and TouchKeys threads
+/*!
+    queueMessage() copies a message of at most three bytes onto a preallocated multiple-producer FIFO and returns, so continuous streams (pressure, vibrato, MRP routing) can be sent from real-time threads without allocating, locking, or waiting on the MIDI driver. The flush thread sleeps until the first message of a batch arrives, waits kMidiOutputQueue_FlushInterval seconds for the rest of it, then sends everything pending through one reused buffer. It doesn't wake up while nothing is being sent.
+
+    Before sending, each batch is coalesced: a control change, pitch bend, or channel or poly aftertouch is dropped if a later message in the same batch updates the same channel/controller (or channel/note) and no other message on that channel comes in between. Everything else is sent in the order it was queued, and the kept updates stay in place relative to notes, so a pitch bend sent before a note off still arrives before it. Channel mode messages (120-127) and the data entry and NRPN/RPN controllers are never coalesced, since their meaning depends on the messages around them.
+
+    The RtMidiOut isn't owned. Detach it with setOutput(NULL) before opening or closing its port, since the flush thread may be sending to it.
+*/
+class MidiOutputQueue {
+    
+    struct Message {
+        int size;
+        unsigned char bytes[3];
+    };
+    
+    RtMidiOut *_output;
+    std::mutex _outputLock;                 // Held while sending or changing the output. Never taken by queueMessage()
+    
+    MultiProducerQueue<Message, kMidiOutputQueue_Size> _queue;
+    std::atomic<unsigned int> _nDropped;    // Messages lost to a full queue since the last flush
+    std::atomic<bool> _pending;             // Whether the flush thread has been woken for the current batch
+    Semaphore _wake;                        // Signalled by the first queueMessage() of a batch
+    
+    /* Flush thread state */
+    Message _batch[kMidiOutputQueue_Size];
+    bool _keep[kMidiOutputQueue_Size];
+    unsigned int _slotStamps[kMidiOutputQueue_NumSlots];        // Stamp of the channel segment a slot was last seen in while scanning a batch backwards
+    unsigned int _channelStamps[kMidiOutputQueue_NumChannels];  // Current segment of each channel. Renewed at every non-coalescable message
+    unsigned int _stamp;
+    std::vector<unsigned char> _buffer;     // Reused for every RtMidiOut::sendMessage() call
+    
+    std::thread _thread;
+    std::atomic<bool> _quit;
+    
+    void flushLoop();
+    void flushLocked();                     // Send all pending messages. Caller holds _outputLock
+    void coalesce(int nMessages);
+    bool send(const unsigned char *bytes, int size);
+    
+    /* Coalescing slot of a message, or -1 if it can't be coalesced */
+    static int slotForMessage(const Message& message);
+    
+public:
+    
+    MidiOutputQueue(RtMidiOut *output = NULL);
+    ~MidiOutputQueue();
+    
+    /* Send anything pending to the current output, then switch to output (NULL to detach). Messages queued while detached are discarded */
+    void setOutput(RtMidiOut *output);
+    
+    /* Queue a message of one to three bytes for the next flush. Real-time safe and callable from any thread. Returns false if the message is malformed or the queue is full */
+    bool queueMessage(const unsigned char *bytes, int size);
+    
+    /* Send all pending messages followed by a message of any length (e.g. sysex) from the calling thread. Not real-time safe */
+    bool sendMessage(const unsigned char *bytes, int size);
+    
+    /* Send all pending messages now from the calling thread */
+    void flush();
+};
+
+#endif /* defined(__MRPSynthGUI__MidiOutputQueue__) */
@@ -0,0 +1,375 @@
+//
+//  OfflineRenderer.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/29/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "OfflineRenderer.h"
+
+/* Standard MIDI files are big-endian; WAV files are little-endian */
+static unsigned int readBE16(const std::vector<unsigned char>& data, size_t pos) {
+    return (data[pos] << 8) | data[pos+1];
+}
+
+static unsigned int readBE32(const std::vector<unsigned char>& data, size_t pos) {
+    return (data[pos] << 24) | (data[pos+1] << 16) | (data[pos+2] << 8) | data[pos+3];
+}
+
+static void writeLE16(FILE *file, unsigned int value) {
+    unsigned char bytes[2] = { (unsigned char)value, (unsigned char)(value >> 8) };
+    fwrite(bytes, 1, 2, file);
+}
+
+static void writeLE32(FILE *file, unsigned int value) {
+    unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+    fwrite(bytes, 1, 4, file);
+}
+
+OfflineRenderer::OfflineRenderer(PolySynth *synth) : _synth(synth) { }
+
+void OfflineRenderer::addEvent(double time, const unsigned char *bytes, int size) {
+    
+    Event event;
+    event.time = std::max(time, 0.0);
+    event.size = std::min(size, 3);
+    memcpy(event.bytes, bytes, event.size);
+    _events.push_back(event);
+}
+
+#pragma mark - MIDI Files
+bool OfflineRenderer::loadMidiFile(std::string path) {
+    
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        printf("%s: Unable to open %s\n", __PRETTY_FUNCTION__, path.c_str());
+        return false;
+    }
+    
+    std::vector<unsigned char> data;
+    unsigned char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.insert(data.end(), chunk, chunk + n);
+    fclose(file);
+    
+    if (data.size() < 14 || memcmp(&data[0], "MThd", 4) != 0) {
+        printf("%s: %s is not a standard MIDI file\n", __PRETTY_FUNCTION__, path.c_str());
+        return false;
+    }
+    
+    size_t headerLength = readBE32(data, 4);
+    int nTracks = readBE16(data, 10);
+    int division = readBE16(data, 12);
+    
+    if (division == 0) {
+        printf("%s: %s has an invalid time division\n", __PRETTY_FUNCTION__, path.c_str());
+        return false;
+    }
+    
+    /* Collect the events and tempo changes (seconds per quarter note) of every track, timed in ticks */
+    std::vector<std::pair<long, Event> > events;
+    std::vector<std::pair<long, double> > tempos;
+    size_t pos = 8 + headerLength;
+    
+    for (int t = 0; t < nTracks && pos + 8 <= data.size(); t++) {
+        
+        size_t length = readBE32(data, pos + 4);
+        size_t start = pos + 8;
+        size_t end = std::min(start + length, data.size());
+        
+        /* Skip unknown chunk types */
+        if (memcmp(&data[pos], "MTrk", 4) == 0 && !parseTrack(data, start, end, &events, &tempos)) {
+            printf("%s: Error reading track %d of %s\n", __PRETTY_FUNCTION__, t, path.c_str());
+            return false;
+        }
+        
+        pos = start + length;
+    }
+    
+    /* Merge the tracks. Events on the same tick stay in track order */
+    std::stable_sort(events.begin(), events.end(), [](const std::pair<long, Event>& a, const std::pair<long, Event>& b) { return a.first < b.first; });
+    std::stable_sort(tempos.begin(), tempos.end());
+    
+    /* Convert ticks to seconds. SMPTE divisions give frames per second (negated) and ticks per frame; otherwise the division is ticks per quarter note at 120 bpm until the first tempo change */
+    double secondsPerTick;
+    if (division & 0x8000) {
+        int fps = -(signed char)(division >> 8);
+        secondsPerTick = 1.0 / (fps * (division & 0xFF));
+        tempos.clear();
+    }
+    else
+        secondsPerTick = 0.5 / division;
+    
+    long tempoTick = 0;         // Tick and time of the last tempo change
+    double tempoTime = 0.0;
+    size_t nextTempo = 0;
+    
+    for (int i = 0; i < events.size(); i++) {
+        
+        while (nextTempo < tempos.size() && tempos[nextTempo].first <= events[i].first) {
+            tempoTime += (tempos[nextTempo].first - tempoTick) * secondsPerTick;
+            tempoTick = tempos[nextTempo].first;
+            secondsPerTick = tempos[nextTempo].second / division;
+            nextTempo++;
+        }
+        
+        events[i].second.time = tempoTime + (events[i].first - tempoTick) * secondsPerTick;
+        _events.push_back(events[i].second);
+    }
+    
+    printf("%s: Loaded %lu events from %s\n", __PRETTY_FUNCTION__, events.size(), path.c_str());
+    return true;
+}
+
+unsigned int OfflineRenderer::readVarLength(const std::vector<unsigned char>& data, size_t *pos, size_t end) {
+    
+    unsigned int value = 0;
+    
+    /* Seven bits per byte, most significant first. The high bit is set on all but the last byte */
+    for (int i = 0; i < 4 && *pos < end; i++) {
+        unsigned char byte = data[(*pos)++];
+        value = (value << 7) | (byte & 0x7F);
+        if (!(byte & 0x80))
+            break;
+    }
+    
+    return value;
+}
+
+bool OfflineRenderer::parseTrack(const std::vector<unsigned char>& data, size_t start, size_t end, std::vector<std::pair<long, Event> > *events, std::vector<std::pair<long, double> > *tempos) {
+    
+    size_t pos = start;
+    long tick = 0;
+    unsigned char status = 0;       // Running status
+    
+    while (pos < end) {
+        
+        tick += readVarLength(data, &pos, end);
+        if (pos >= end)
+            break;
+        
+        unsigned char byte = data[pos];
+        
+        /* Meta events. Only tempo changes and the end of the track are used */
+        if (byte == 0xFF) {
+            
+            if (pos + 2 > end)
+                return false;
+            
+            unsigned char type = data[pos+1];
+            pos += 2;
+            unsigned int length = readVarLength(data, &pos, end);
+            
+            if (type == 0x51 && length == 3 && pos + 3 <= end)
+                tempos->push_back(std::make_pair(tick, ((data[pos] << 16) | (data[pos+1] << 8) | data[pos+2]) / 1.0e6));
+            
+            if (type == 0x2F)
+                break;
+            
+            pos += length;
+            continue;
+        }
+        
+        /* SysEx messages are skipped */
+        if (byte == 0xF0 || byte == 0xF7) {
+            pos++;
+            unsigned int length = readVarLength(data, &pos, end);
+            pos += length;
+            continue;
+        }
+        
+        /* Channel messages, with or without a status byte */
+        if (byte & 0x80) {
+            if (byte > 0xEF)
+                return false;
+            status = byte;
+            pos++;
+        }
+        else if (!status)
+            return false;
+        
+        int nData = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+        if (pos + nData > end)
+            return false;
+        
+        Event event;
+        event.time = 0.0;
+        event.size = 1 + nData;
+        event.bytes[0] = status;
+        event.bytes[1] = data[pos];
+        event.bytes[2] = nData > 1 ? data[pos+1] : 0;
+        events->push_back(std::make_pair(tick, event));
+        
+        pos += nData;
+    }
+    
+    return true;
+}
+
+#pragma mark - Rendering
+bool OfflineRenderer::render(std::string path, OfflineFileFormat format, double tailSeconds) {
+    
+    int nChannels = _synth->numVoices();
+    int fs = _synth->sampleRate();
+    
+    if (nChannels <= 0) {
+        printf("%s: The PolySynth has no voices\n", __PRETTY_FUNCTION__);
+        return false;
+    }
+    
+    std::stable_sort(_events.begin(), _events.end(), [](const Event& a, const Event& b) { return a.time < b.time; });
+    
+    double duration = (_events.empty() ? 0.0 : _events.back().time) + tailSeconds;
+    double nFramesRequested = ceil(std::max(duration, 0.0) * fs);
+    
+    /* The frame counter is 32 bits, and RIFF sizes can't describe more than 4 GB. Refuse up front rather than write a file with a wrapped header */
+    if (nFramesRequested > (double)UINT_MAX) {
+        printf("%s: %.0f frames is too long to render\n", __PRETTY_FUNCTION__, nFramesRequested);
+        return false;
+    }
+    unsigned int nFrames = (unsigned int)nFramesRequested;
+    
+    if (format == kOfflineFileFormat_Wav && !wavSizeFits(nChannels, nFrames)) {
+        printf("%s: %.2f s of %d channel audio exceeds the 4 GB WAV limit. Render to raw instead\n", __PRETTY_FUNCTION__, duration, nChannels);
+        return false;
+    }
+    
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("%s: Unable to open %s for writing\n", __PRETTY_FUNCTION__, path.c_str());
+        return false;
+    }
+    
+    if (format == kOfflineFileFormat_Wav)
+        writeWavHeader(file, nChannels, fs, nFrames);
+    
+    std::vector<float> channelBuffer(nChannels * kOfflineRenderer_BlockSize);
+    std::vector<float*> channelPtrs(nChannels);
+    std::vector<float> interleaved(nChannels * kOfflineRenderer_BlockSize);
+    std::vector<unsigned char> message;
+    
+    for (int ch = 0; ch < nChannels; ch++)
+        channelPtrs[ch] = &channelBuffer[ch * kOfflineRenderer_BlockSize];
+    
+    /* Voices do any deferred work (e.g. building wavetables) inline, so it lands on the same sample every time */
+    SynthVoice *master = _synth->masterVoice();
+    if (master)
+        master->setOfflineRendering(true);
+    
+    /* Start the PolySynth's event clock at the first frame without rendering anything */
+    _synth->renderBlock(channelPtrs.data(), nChannels, 0, kOfflineRenderer_StartTime);
+    
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    size_t nextEvent = 0;
+    bool ok = true;
+    int midiNum, channel;
+    
+    for (unsigned int frame = 0, n; frame < nFrames && ok; frame += n) {
+        
+        n = std::min(nFrames - frame, (unsigned int)kOfflineRenderer_BlockSize);
+        
+        /* Queue the events in this block, rounded to the nearest frame and stamped at the middle of it so PolySynth places each on the right one. If the queue fills up, the rest wait for the next block */
+        while (nextEvent < _events.size()) {
+            
+            const Event& event = _events[nextEvent];
+            unsigned int eventFrame = (unsigned int)(event.time * fs + 0.5);
+            if (eventFrame >= frame + n)
+                break;
+            
+            if (!_synth->queueEvent(event.bytes, event.size, kOfflineRenderer_StartTime + (eventFrame + 0.5) / fs))
+                break;
+            
+            /* queueMidiControl() would also update the master voice with global control messages. Do the same so it stays in sync with the instance voices */
+            if ((event.bytes[0] & 0xF0) != 0x80 && (event.bytes[0] & 0xF0) != 0x90 && !_synth->isPerNoteMessage(event.bytes, event.size) && _synth->masterVoice()) {
+                message.assign(event.bytes, event.bytes + event.size);
+                _synth->masterVoice()->handleMidi(&message, NULL);
+            }
+            
+            nextEvent++;
+        }
+        
+        _synth->renderBlock(channelPtrs.data(), nChannels, n, kOfflineRenderer_StartTime + (double)(frame + n) / fs);
+        
+        /* Nobody's listening for voice allocations, so don't let them fill the queue */
+        while (_synth->nextVoiceAllocation(&midiNum, &channel)) ;
+        
+        for (int i = 0; i < n; i++) {
+            for (int ch = 0; ch < nChannels; ch++)
+                interleaved[i * nChannels + ch] = channelPtrs[ch][i];
+        }
+        
+        ok = fwrite(interleaved.data(), sizeof(float), n * nChannels, file) == n * nChannels;
+    }
+    
+    if (master)
+        master->setOfflineRendering(false);
+    
+    ok = (fclose(file) == 0) && ok;
+    
+    if (!ok) {
+        printf("%s: Error writing %s\n", __PRETTY_FUNCTION__, path.c_str());
+        return false;
+    }
+    
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    printf("%s: Rendered %.2f s of audio (%d channels) to %s in %.3f s (%.1fx realtime)\n", __PRETTY_FUNCTION__, (double)nFrames / fs, nChannels, path.c_str(), elapsed, elapsed > 0.0 ? nFrames / (fs * elapsed) : 0.0);
+    
+    return true;
+}
+
+/* Size of the format chunk body: plain WAVEFORMATEX for mono and stereo, WAVEFORMATEXTENSIBLE with a channel mask beyond that */
+static unsigned int wavFormatChunkSize(int nChannels) {
+    return nChannels > 2 ? 40 : 18;
+}
+
+bool OfflineRenderer::wavSizeFits(int nChannels, unsigned int nFrames) {
+    
+    uint64_t dataSize = (uint64_t)nFrames * nChannels * sizeof(float);
+    uint64_t riffSize = 4 + (8 + wavFormatChunkSize(nChannels)) + (8 + 4) + (8 + dataSize);
+    
+    return riffSize <= UINT_MAX;
+}
+
+void OfflineRenderer::writeWavHeader(FILE *file, int nChannels, int sampleRate, unsigned int nFrames) {
+    
+    /* Caller has checked wavSizeFits(), so neither size wraps */
+    unsigned int dataSize = nFrames * nChannels * sizeof(float);
+    unsigned int formatSize = wavFormatChunkSize(nChannels);
+    bool extensible = nChannels > 2;
+    
+    fwrite("RIFF", 1, 4, file);
+    writeLE32(file, 4 + (8 + formatSize) + (8 + 4) + (8 + dataSize));
+    fwrite("WAVE", 1, 4, file);
+    
+    /* Format chunk for IEEE float samples */
+    fwrite("fmt ", 1, 4, file);
+    writeLE32(file, formatSize);
+    writeLE16(file, extensible ? 0xFFFE : 3);                   // WAVE_FORMAT_EXTENSIBLE or WAVE_FORMAT_IEEE_FLOAT
+    writeLE16(file, nChannels);
+    writeLE32(file, sampleRate);
+    writeLE32(file, sampleRate * nChannels * sizeof(float));    // Bytes per second
+    writeLE16(file, nChannels * sizeof(float));                 // Bytes per frame
+    writeLE16(file, 8 * sizeof(float));                         // Bits per sample
+    
+    if (extensible) {
+        
+        /* Readers reject WAVE_FORMAT_IEEE_FLOAT with more than two channels. Each channel is a synth voice rather than a speaker, so the channel mask assigns no positions */
+        static const unsigned char kFloatSubFormat[16] = { 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+        writeLE16(file, 22);                                    // Extension size
+        writeLE16(file, 8 * sizeof(float));                     // Valid bits per sample
+        writeLE32(file, kOfflineRenderer_WavChannelMask);
+        fwrite(kFloatSubFormat, 1, sizeof(kFloatSubFormat), file);     // KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+    }
+    else
+        writeLE16(file, 0);                                     // No extension
+    
+    /* Non-PCM formats require a fact chunk with the number of frames */
+    fwrite("fact", 1, 4, file);
+    writeLE32(file, 4);
+    writeLE32(file, nFrames);
+    
+    fwrite("data", 1, 4, file);
+    writeLE32(file, dataSize);
+}
@@ -0,0 +1,73 @@
+//
+//  OfflineRenderer.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/29/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__OfflineRenderer__
+#define __MRPSynthGUI__OfflineRenderer__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <stdint.h>
+
+#include "PolySynth.h"
+
+#define kOfflineRenderer_BlockSize 512          // Frames rendered per call to PolySynth::renderBlock()
+#define kOfflineRenderer_DefaultTail 2.0        // Seconds rendered after the last event so releases can finish
+#define kOfflineRenderer_StartTime 1.0          // Event clock time of the first frame. Non-zero so PolySynth places events in the first block at their exact frame
+#define kOfflineRenderer_WavChannelMask 0       // Speaker positions of WAV files with more than two channels. None, since each channel is a voice
+
+typedef enum OfflineFileFormat {
+    kOfflineFileFormat_Wav = 0,     // 32-bit float WAV
+    kOfflineFileFormat_Raw          // Headerless interleaved 32-bit float (native byte order)
+} OfflineFileFormat;
+
+//! Renders a PolySynth to a file as fast as possible, without an audio device
+/*!
+    Events are added from a standard MIDI file with loadMidiFile() or one at a time with addEvent(), both timed in seconds from the start of the render. render() then drives the PolySynth block by block with PolySynth::renderBlock(float**, int, int, double), using the output time instead of the host clock, so every event lands on its exact sample and the result doesn't depend on how fast the machine is. Each voice is written to its own channel, as the AudioController does with a live stream.
+
+    The PolySynth shouldn't be rendered by an AudioController at the same time.
+*/
+class OfflineRenderer {
+    
+    struct Event {
+        double time;                // Seconds from the start of the render
+        int size;
+        unsigned char bytes[3];
+    };
+    
+    PolySynth *_synth;
+    std::vector<Event> _events;     // Sorted by time when rendering
+    
+    /* Standard MIDI file parsing */
+    static unsigned int readVarLength(const std::vector<unsigned char>& data, size_t *pos, size_t end);
+    bool parseTrack(const std::vector<unsigned char>& data, size_t start, size_t end, std::vector<std::pair<long, Event> > *events, std::vector<std::pair<long, double> > *tempos);
+    
+    /* Whether a WAV file of nFrames frames stays within the 32-bit RIFF sizes */
+    static bool wavSizeFits(int nChannels, unsigned int nFrames);
+    static void writeWavHeader(FILE *file, int nChannels, int sampleRate, unsigned int nFrames);
+    
+public:
+    
+    OfflineRenderer(PolySynth *synth);
+    
+    /* Add a raw MIDI message (at most three bytes) at time seconds */
+    void addEvent(double time, const unsigned char *bytes, int size);
+    void clearEvents() { _events.clear(); }
+    int numEvents() { return (int)_events.size(); }
+    
+    /* Add the channel messages of all tracks of a standard MIDI file (format 0 or 1), converting ticks to seconds with the file's tempo map. Returns false if the file can't be read or isn't a MIDI file */
+    bool loadMidiFile(std::string path);
+    
+    /* Render from time zero until tailSeconds after the last event into a file with one channel per synth voice. Returns false if the file can't be written, or would exceed the 4 GB limit of a WAV file */
+    bool render(std::string path, OfflineFileFormat format, double tailSeconds = kOfflineRenderer_DefaultTail);
+};
+
+#endif /* defined(__MRPSynthGUI__OfflineRenderer__) */
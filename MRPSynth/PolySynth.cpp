@@ -8,153 +8,629 @@
 
 #include "PolySynth.h"
 
-PolySynth::PolySynth() : _masterVoice(NULL), _fs(44100.0f), _nVoices(0), _nActiveVoices(0), _noteCount(1) { }
+PolySynth::PolySynth() : _fs(44100.0f), _masterVoice(NULL), _nVoices(0), _nRequestedVoices(0), _nActiveVoices(0), _voiceSlab(NULL), _noteCount(1), _pendingVoiceSet(NULL), _requestedFilterType(-1), _requestedSampleRate(0.0f), _voiceFilterType(-1), _voiceSampleRate(0.0f), _nKeysHeld(0), _stealingPolicy(kVoiceStealingPolicy_LowestPriority), _requestedStealingPolicy(kVoiceStealingPolicy_LowestPriority), _silenceLevel(powf(10.0f, kPolySynth_DefaultSilenceThreshold / 20.0f)), _lastEventTime(0.0), _allocationListener(NULL), _allocationListenerData(NULL), _allocationsQueued(false), _globalParams(NULL), _nGlobalParams(0), _latestGlobalParams(NULL), _nLatestGlobalParams(0), _paramVersion(0), _perNoteChannelMask(0), _midiDispatch(NULL), _pendingMidiDispatch(NULL) {
+    
+    _eventQueueLock.clear();
+    
+    memset(_keysHeld, 0, sizeof(_keysHeld));
+    for (int i = 0; i < kPolySynth_NumMidiChannels; i++)
+        _channelNotes[i] = -1;
+    for (int i = 0; i < kPolySynth_ParamRingSize; i++)
+        _paramRing[i].store(-1);
+    for (int i = 0; i < kPolySynth_NumNoteControls; i++) {
+        _noteControlChannels[i].store(-1);
+        for (int j = 0; j < kPolySynth_NumMidiNotes; j++)
+            _noteControlValues[i][j].store(-1);
+        for (int j = 0; j < kPolySynth_NumMidiNotes / 32; j++)
+            _noteControlDirty[i][j].store(0);
+    }
+    resetVoiceAllocation();
+}
 
-PolySynth::PolySynth(SynthVoice* master, int numVoices) : _masterVoice(master), _fs(master->sampleRate()), _nVoices(numVoices), _nActiveVoices(0), _noteCount(1) {
+PolySynth::PolySynth(SynthVoice* master, int numVoices) : _fs(master->sampleRate()), _masterVoice(master), _nVoices(0), _nRequestedVoices(numVoices), _nActiveVoices(0), _voiceSlab(NULL), _noteCount(1), _pendingVoiceSet(NULL), _requestedFilterType(-1), _requestedSampleRate(0.0f), _voiceFilterType(-1), _voiceSampleRate(0.0f), _nKeysHeld(0), _stealingPolicy(kVoiceStealingPolicy_LowestPriority), _requestedStealingPolicy(kVoiceStealingPolicy_LowestPriority), _silenceLevel(powf(10.0f, kPolySynth_DefaultSilenceThreshold / 20.0f)), _lastEventTime(0.0), _allocationListener(NULL), _allocationListenerData(NULL), _allocationsQueued(false), _globalParams(NULL), _nGlobalParams(0), _latestGlobalParams(NULL), _nLatestGlobalParams(0), _paramVersion(0), _perNoteChannelMask(0), _midiDispatch(NULL), _pendingMidiDispatch(NULL) {
+    
+    _eventQueueLock.clear();
+    
+    memset(_keysHeld, 0, sizeof(_keysHeld));
+    for (int i = 0; i < kPolySynth_NumMidiChannels; i++)
+        _channelNotes[i] = -1;
+    for (int i = 0; i < kPolySynth_ParamRingSize; i++)
+        _paramRing[i].store(-1);
+    for (int i = 0; i < kPolySynth_NumNoteControls; i++) {
+        _noteControlChannels[i].store(-1);
+        for (int j = 0; j < kPolySynth_NumMidiNotes; j++)
+            _noteControlValues[i][j].store(-1);
+        for (int j = 0; j < kPolySynth_NumMidiNotes / 32; j++)
+            _noteControlDirty[i][j].store(0);
+    }
     
     setMasterVoice(master);
 }
 
+PolySynth::~PolySynth() {
+    
+    /* The audio thread must have stopped by now, so free the rendered set along with any that are pending or retired */
+    VoiceSet *set = new VoiceSet();
+    set->slab = NULL;
+    set->globalParams = NULL;
+    set->nGlobalParams = 0;
+    swapVoiceSet(set);
+    freeVoiceSet(set);
+    freeVoiceSet(_pendingVoiceSet.exchange(NULL));
+    reclaimVoiceSets();
+    
+    MidiDispatchTable *table;
+    delete _midiDispatch;
+    delete _pendingMidiDispatch.exchange(NULL);
+    while (_retiredMidiDispatch.pop(&table))
+        delete table;
+}
+
 void PolySynth::setMasterVoice(SynthVoice* master) {
     
-    printf("%s: Setting master voice with parameters:", __PRETTY_FUNCTION__);
-    master->parameterListPrint();
+    reclaimVoiceSets();
     
     _masterVoice = master;
     
-    _voices.clear();
+    /* If the voices can't be allocated, keep rendering the current ones */
+    VoiceSet *set = buildVoiceSet(master, _nRequestedVoices);
+    if (!set)
+        return;
     
-    /* Create the Note structs. Voices clone the master voice */
-    for (int vc = 0; vc < _nVoices; vc++) {
-        
-        printf("%s: Creating instance voice %d from master voice\n", __PRETTY_FUNCTION__, vc);
-       
-        Voice note;
-        note.v = new SynthVoice(_masterVoice);
-        
-        note.midiNum = -1;
-        note.priority = 0;
-        _voices.push_back(note);
-    }
+    /* Parameter changes from here on are for the new voices. The old ones keep the values they have until they're replaced */
+    _latestGlobalParams = set->globalParams;
+    _nLatestGlobalParams = set->nGlobalParams;
+    
+    /* Hand the new voices to the audio thread. A set published earlier that it hasn't taken yet was never rendered, so it can be freed right away */
+    freeVoiceSet(_pendingVoiceSet.exchange(set, std::memory_order_acq_rel));
+    
+    rebuildMidiDispatch();
+    
+    printf("%s: Created %d instance voices from master voice\n", __PRETTY_FUNCTION__, _nRequestedVoices);
 }
 
-void PolySynth::setMasterVoice(AdditiveSynthVoice* master) {
+PolySynth::VoiceSet* PolySynth::buildVoiceSet(SynthVoice *master, int nVoices) {
     
-    printf("%s: Setting master voice with parameters:", __PRETTY_FUNCTION__);
+    VoiceSet *set = new VoiceSet();
+    set->slab = NULL;
     
-    _masterVoice = master;
-    _masterVoice->parameterListPrint();
+    /* The clones start with the master's current values, so only changes made after this need to reach them */
+    set->nGlobalParams = master->numParameters();
+    set->globalParams = new GlobalParameter[set->nGlobalParams];
+    for (int i = 0; i < set->nGlobalParams; i++) {
+        set->globalParams[i].version.store(0);
+        set->globalParams[i].midiVersion = 0;
+    }
     
-    _voices.clear();
+    /* Clone the master voice into one contiguous block. Each voice starts on its own cache line and is followed by the storage for its parameters */
+    size_t voiceSize = (master->cloneSize() + kPolySynth_VoiceAlignment - 1) & ~(size_t)(kPolySynth_VoiceAlignment - 1);
+    size_t paramSize = (master->parameterStorageSize() + kPolySynth_VoiceAlignment - 1) & ~(size_t)(kPolySynth_VoiceAlignment - 1);
+    size_t stride = voiceSize + paramSize;
+    if (nVoices > 0 && posix_memalign(&set->slab, kPolySynth_VoiceAlignment, nVoices * stride) != 0) {
+        printf("%s: Error allocating %d synth voices\n", __PRETTY_FUNCTION__, nVoices);
+        delete[] set->globalParams;
+        delete set;
+        return NULL;
+    }
     
     /* Create the Note structs. Voices clone the master voice */
-    for (int vc = 0; vc < _nVoices; vc++) {
+    set->voices.reserve(nVoices);
+    for (int vc = 0; vc < nVoices; vc++) {
         
-        printf("%s: Creating instance voice %d from master voice\n", __PRETTY_FUNCTION__, vc);
+        char *slot = (char *)set->slab + vc * stride;
         
         Voice note;
-        note.v = new AdditiveSynthVoice(master);
+        SynthParameter::setAllocationArena(slot + voiceSize, paramSize);
+        note.v = master->clone(slot);
+        SynthParameter::clearAllocationArena();
+        note.v->commitParameters();
         
         note.midiNum = -1;
         note.priority = 0;
-        _voices.push_back(note);
+        note.onset = 0;
+        note.released = false;
+        note.heapIdx = -1;
+        note.freeIdx = -1;
+        note.paramVersion = _paramVersion.load();
+        set->voices.push_back(note);
+        set->voices.back().overrides.reserve(set->nGlobalParams);
     }
+    
+    /* Size the scratch lists here so the audio thread doesn't allocate when it swaps the set in */
+    set->filters.resize(nVoices);
+    set->filterBuffers.resize(nVoices);
+    set->activeChannels.reserve(nVoices);
+    set->freeVoices.reserve(nVoices);
+    set->stealHeap.reserve(nVoices);
+    
+    return set;
 }
 
-void PolySynth::setMasterVoice(SubtractiveSynthVoice* master) {
+void PolySynth::freeVoiceSet(VoiceSet *set) {
     
-    printf("%s: Setting master voice with parameters:", __PRETTY_FUNCTION__);
+    if (!set)
+        return;
     
-    _masterVoice = master;
-    _masterVoice->parameterListPrint();
+    for (int vc = 0; vc < set->voices.size(); vc++)
+        set->voices[vc].v->~SynthVoice();
     
-    _voices.clear();
+    free(set->slab);
+    delete[] set->globalParams;
+    delete set;
+}
+
+void PolySynth::reclaimVoiceSets() {
     
-    /* Create the Note structs. Voices clone the master voice */
-    for (int vc = 0; vc < _nVoices; vc++) {
+    VoiceSet *set;
+    
+    /* Sets are only retired when the audio thread takes a pending set. Each call to setMasterVoice() reclaims before it publishes, so at most two (retired by the previous two publishes) can be waiting here */
+    while (_retiredVoiceSets.pop(&set))
+        freeVoiceSet(set);
+}
+
+void PolySynth::swapVoiceSet(VoiceSet *set) {
+    
+    _voices.swap(set->voices);
+    std::swap(_voiceSlab, set->slab);
+    _filters.swap(set->filters);
+    _filterBuffers.swap(set->filterBuffers);
+    _activeChannels.swap(set->activeChannels);
+    _freeVoices.swap(set->freeVoices);
+    _stealHeap.swap(set->stealHeap);
+    std::swap(_globalParams, set->globalParams);
+    std::swap(_nGlobalParams, set->nGlobalParams);
+    
+    _nVoices = (int)_voices.size();
+}
+
+void PolySynth::applyVoiceUpdates() {
+    
+    /* Swap in a new voice set and pass the old one back to be freed. The clones have the master voice's settings, so the requested settings are applied to them again below */
+    VoiceSet *set = _pendingVoiceSet.exchange(NULL, std::memory_order_acq_rel);
+    if (set) {
         
-        printf("%s: Creating instance voice %d from master voice\n", __PRETTY_FUNCTION__, vc);
+        swapVoiceSet(set);
+        resetVoiceAllocation();
         
-        Voice note;
-        note.v = new SubtractiveSynthVoice(master);
+        if (!_retiredVoiceSets.push(set))
+            RealtimeLog::log(kLogLevel_Error, "%s: Retired voice set queue full. Leaking %d voices\n", __PRETTY_FUNCTION__, (int)set->voices.size());
         
-        note.midiNum = -1;
-        note.priority = 0;
-        _voices.push_back(note);
+        _voiceFilterType = -1;
+        _voiceSampleRate = 0.0f;
+    }
+    
+    /* Swap in a new MIDI dispatch table and pass the old one back to be freed */
+    MidiDispatchTable *table = _pendingMidiDispatch.exchange(NULL, std::memory_order_acq_rel);
+    if (table) {
+        
+        if (_midiDispatch && !_retiredMidiDispatch.push(_midiDispatch))
+            RealtimeLog::log(kLogLevel_Error, "%s: Retired MIDI dispatch queue full. Leaking table\n", __PRETTY_FUNCTION__);
+        _midiDispatch = table;
+    }
+    
+    int type = _requestedFilterType.load(std::memory_order_relaxed);
+    if (type != _voiceFilterType) {
+        
+        if (type >= 0) {
+            for (int vc = 0; vc < _nVoices; vc++)
+                _voices[vc].v->setFilterType((BiquadFilterType)type);
+        }
+        _voiceFilterType = type;
+    }
+    
+    float fs = _requestedSampleRate.load(std::memory_order_relaxed);
+    if (fs != _voiceSampleRate) {
+        
+        if (fs > 0.0f) {
+            for (int vc = 0; vc < _nVoices; vc++)
+                _voices[vc].v->setSampleRate(fs);
+        }
+        _voiceSampleRate = fs;
     }
 }
 
 bool PolySynth::setMasterVoiceParam(string paramName, float value, bool doRamp) {
     
     /* Make sure the parameter exists */
-    if (!_masterVoice->hasParameter(paramName)) {
-        printf("%s: No parameter with name %s\n", __PRETTY_FUNCTION__, paramName.c_str());
+    int id = _masterVoice->getParameterID(paramName);
+    if (id < 0) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: No parameter with name %s\n", __PRETTY_FUNCTION__, paramName.c_str());
         return false;
     }
     
-    /* Set the value for the master voice and all channel voices */
-    _masterVoice->setParameterValue(paramName, value, doRamp);
-    for (int i = 0; i < _nVoices; i++) {
-        _voices[i].v->setParameterValue(paramName, value, doRamp);
+    /* Set the value for the master voice */
+    SynthParameter *param = _masterVoice->getParameterWithID(id);
+    if (doRamp)
+        param->setValue(value);
+    else
+        *param = value;
+    
+    /* Publish it for the instance voices. The ring entry and slot are written before the version is bumped, so the audio thread never sees the new version without the new value. The ring entry is a release store so a reader that sees it also sees the version before it (see syncVoiceParams()) */
+    if (id < _nLatestGlobalParams) {
+        
+        unsigned int version = _paramVersion.load(std::memory_order_relaxed) + 1;
+        _paramRing[version & (kPolySynth_ParamRingSize - 1)].store(id, std::memory_order_release);
+        _latestGlobalParams[id].value.store(value, std::memory_order_relaxed);
+        _latestGlobalParams[id].ramp.store(doRamp, std::memory_order_relaxed);
+        _latestGlobalParams[id].version.store(version, std::memory_order_release);
+        _paramVersion.store(version, std::memory_order_release);
     }
     
     return true;
 }
 
-bool PolySynth::addMasterVoiceMidiMapping(MidiMapping *map) {
+void PolySynth::syncVoiceParams(int channel) {
     
-    /* Set the value for the master voice and all channel voices */
-//    _masterVoice->setParameterValue(paramName, value, doRamp);
-    _masterVoice->addMidiMapping(map);
-    for (int i = 0; i < _nVoices; i++) {
-        _voices[i].v->addMidiMapping(map);
+    Voice& voice = _voices[channel];
+    unsigned int version = _paramVersion.load(std::memory_order_acquire);
+    
+    if (voice.paramVersion == version)
+        return;
+    
+    /* Visit only the parameters set since the voice was last synced, through the ring of changed IDs. An ID set more than once is applied at its latest change, unless it's set again while we're reading, in which case applying it twice is harmless */
+    bool synced = false;
+    if (version - voice.paramVersion < kPolySynth_ParamRingSize) {
+        
+        for (unsigned int v = voice.paramVersion + 1; v != version + 1; v++) {
+        
+            int id = _paramRing[v & (kPolySynth_ParamRingSize - 1)].load(std::memory_order_relaxed);
+            if (id < 0 || id >= _nGlobalParams)
+                continue;
+        
+            unsigned int latest = _globalParams[id].version.load(std::memory_order_acquire);
+            if (latest == v || latest > version)
+                applyGlobalParam(channel, id);
+        }
+        
+        /* The UI thread overwrites the entry for version v when it writes version v + kPolySynth_ParamRingSize. If it may have got that far while we were reading, some IDs may have been missed */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        synced = _paramVersion.load(std::memory_order_relaxed) - voice.paramVersion < kPolySynth_ParamRingSize;
     }
     
-    return true;
+    /* Too far behind for the ring. Check every parameter */
+    if (!synced) {
+        for (int id = 0; id < _nGlobalParams; id++)
+            applyGlobalParam(channel, id);
+    }
+    
+    voice.paramVersion = version;
 }
 
-bool PolySynth::removeMasterVoiceMidiMapping(MidiMapping *map) {
+void PolySynth::applyGlobalParam(int channel, int id) {
+    
+    Voice& voice = _voices[channel];
+    GlobalParameter& global = _globalParams[id];
+    
+    unsigned int version = global.version.load(std::memory_order_acquire);
+    if (version <= voice.paramVersion || version <= global.midiVersion)
+        return;
+    
+    SynthParameter *param = voice.v->getParameterWithID(id);
+    if (!param)
+        return;
     
-    _masterVoice->removeMidiMapping(map);
-    for (int i = 0; i < _nVoices; i++) {
-        _voices[i].v->removeMidiMapping(map);
+    float value = global.value.load(std::memory_order_relaxed);
+    if (global.ramp.load(std::memory_order_relaxed))
+        param->setValue(value);
+    else
+        *param = value;
+    
+    /* The global value replaces any per-note value */
+    if (!voice.overrides.empty())
+        clearOverride(channel, id);
+}
+
+void PolySynth::syncActiveVoices() {
+    
+    for (int vc = 0; vc < _nVoices; vc++) {
+        if (_voices[vc].priority > 0)
+            syncVoiceParams(vc);
     }
+}
+
+#pragma mark - Per-Note Control
+bool PolySynth::isPerNoteMessage(const unsigned char *bytes, int size) {
     
-    return true;
+    if (size < 2 || size > 3)
+        return false;
+    
+    int messageType = bytes[0] & 0xF0;
+    
+    /* Polyphonic aftertouch always names its note */
+    if (messageType == 0xA0)
+        return size == 3;
+    
+    if (messageType != 0xB0 && messageType != 0xD0 && messageType != 0xE0)
+        return false;
+    
+    return (_perNoteChannelMask.load(std::memory_order_relaxed) >> (bytes[0] & 0x0F)) & 1;
+}
+
+void PolySynth::setPerNoteChannels(int first, int last) {
+    
+    int mask = 0;
+    for (int ch = std::max(first, 0); ch <= last && ch < kPolySynth_NumMidiChannels; ch++)
+        mask |= 1 << ch;
+    
+    _perNoteChannelMask.store(mask);
+}
+
+void PolySynth::setNoteControlChannel(int source, int channel) {
+    
+    if (source < 0 || source >= kPolySynth_NumNoteControls)
+        return;
+    
+    _noteControlChannels[source].store(channel >= 0 && channel < kPolySynth_NumMidiChannels ? channel : -1);
+}
+
+int PolySynth::noteControlChannel(int source) {
+    
+    if (source < 0 || source >= kPolySynth_NumNoteControls)
+        return -1;
+    
+    return _noteControlChannels[source].load();
+}
+
+void PolySynth::setNoteControl(int source, int midiNote, float value) {
+    
+    if (source < 0 || source >= kPolySynth_NumNoteControls || midiNote < 0 || midiNote >= kPolySynth_NumMidiNotes)
+        return;
+    
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    int midiValue = (int)(value * 127.0f + 0.5f);
+    
+    /* Only changes of the controller value reach the audio thread. The value is stored before the dirty bit is set, so the audio thread never applies a stale one */
+    if (_noteControlValues[source][midiNote].exchange(midiValue, std::memory_order_relaxed) != midiValue)
+        _noteControlDirty[source][midiNote / 32].fetch_or(1u << (midiNote % 32), std::memory_order_release);
+}
+
+void PolySynth::applyNoteControls() {
+    
+    for (int src = 0; src < kPolySynth_NumNoteControls; src++) {
+        
+        int channel = _noteControlChannels[src].load(std::memory_order_relaxed);
+        
+        for (int w = 0; w < kPolySynth_NumMidiNotes / 32; w++) {
+            
+            unsigned int dirty = _noteControlDirty[src][w].exchange(0, std::memory_order_acquire);
+            
+            /* Changes to notes without a voice (or while the source is disabled) are dropped. A new note picks up the key's next change */
+            for (int bit = 0; dirty && channel >= 0; bit++, dirty >>= 1) {
+                
+                if (!(dirty & 1))
+                    continue;
+                
+                int midiNote = w * 32 + bit;
+                if (_noteVoices[midiNote] < 0)
+                    continue;
+                
+                unsigned char bytes[3] = { (unsigned char)(0xA0 | channel), (unsigned char)midiNote, (unsigned char)_noteControlValues[src][midiNote].load(std::memory_order_relaxed) };
+                dispatchNoteMidi(_noteVoices[midiNote], bytes, 3);
+            }
+        }
+    }
+}
+
+int PolySynth::noteMessageVoice(const unsigned char *bytes, int size) {
+    
+    int midiNum = (bytes[0] & 0xF0) == 0xA0 ? bytes[1] & 0x7F : _channelNotes[bytes[0] & 0x0F];
+    return midiNum >= 0 ? _noteVoices[midiNum] : -1;
+}
+
+void PolySynth::dispatchNoteMidi(int channel, const unsigned char *bytes, int size) {
+    
+    MidiDispatchTable *table = _midiDispatch;
+    if (!table)
+        return;
+    
+    const MidiDispatchEntry *entries;
+    int n;
+    
+    /* Polyphonic aftertouch uses mappings with data byte 0 for every note, and mappings with the note number for that note only */
+    if ((bytes[0] & 0xF0) == 0xA0) {
+        
+        if (channel < 0)
+            return;
+        
+        int value;
+        unsigned char anyNote[3] = { bytes[0], 0, bytes[2] };
+        if ((n = table->lookup(anyNote, 3, &entries, &value)))
+            applyNoteEntries(channel, entries, n, value / 127.0f);
+        
+        if (bytes[1] != 0 && (n = table->lookup(bytes, size, &entries, &value)))
+            applyNoteEntries(channel, entries, n, value / 127.0f);
+        
+        return;
+    }
+    
+    /* Messages on any per-note channel use the mappings of the first one. They're parsed even if no voice is playing the channel's note, so 14-bit and (N)RPN state stays current */
+    int mask = _perNoteChannelMask.load(std::memory_order_relaxed);
+    int firstChannel = 0;
+    while (firstChannel < kPolySynth_NumMidiChannels - 1 && !((mask >> firstChannel) & 1))
+        firstChannel++;
+    
+    float position;
+    n = table->resolve(bytes, size, &_midiParser, firstChannel, &entries, &position);
+    if (n && channel >= 0)
+        applyNoteEntries(channel, entries, n, position);
+}
+
+void PolySynth::applyNoteEntries(int channel, const MidiDispatchEntry *entries, int n, float position) {
+    
+    Voice& voice = _voices[channel];
+    
+    /* Apply earlier global changes first so they don't replace this one */
+    syncVoiceParams(channel);
+    
+    for (int i = 0; i < n; i++) {
+        
+        SynthParameter *param = voice.v->getParameterWithID(entries[i].parameterID);
+        if (!param)
+            continue;
+        
+        /* Remember the global value the first time the note changes this parameter */
+        int j = 0;
+        while (j < (int)voice.overrides.size() && voice.overrides[j].parameterID != entries[i].parameterID)
+            j++;
+        
+        if (j == (int)voice.overrides.size() && j < (int)voice.overrides.capacity()) {
+            NoteOverride o = { entries[i].parameterID, param->targetValue() };
+            voice.overrides.push_back(o);
+        }
+        
+        MidiDispatchTable::apply(entries[i], param, MidiDispatchTable::mappedValue(entries[i], position));
+    }
+}
+
+void PolySynth::clearOverride(int channel, int parameterID) {
+    
+    std::vector<NoteOverride>& overrides = _voices[channel].overrides;
+    
+    for (int j = 0; j < (int)overrides.size(); j++) {
+        if (overrides[j].parameterID == parameterID) {
+            overrides[j] = overrides.back();
+            overrides.pop_back();
+            return;
+        }
+    }
+}
+
+void PolySynth::restoreOverrides(int channel) {
+    
+    Voice& voice = _voices[channel];
+    
+    for (int j = 0; j < (int)voice.overrides.size(); j++) {
+        SynthParameter *param = voice.v->getParameterWithID(voice.overrides[j].parameterID);
+        if (param)
+            *param = voice.overrides[j].baseValue;
+    }
+    
+    voice.overrides.clear();
+}
+
+bool PolySynth::addMasterVoiceMidiMapping(MidiMapping *map) {
+    
+    /* Instance voices share the master voice's mappings through the dispatch table */
+    bool added = _masterVoice->addMidiMapping(map);
+    rebuildMidiDispatch();
+    
+    return added;
+}
+
+bool PolySynth::removeMasterVoiceMidiMapping(MidiMapping *map) {
+    
+    bool removed = _masterVoice->removeMidiMapping(map);
+    rebuildMidiDispatch();
+    
+    return removed;
+}
+
+void PolySynth::rebuildMidiDispatch() {
+    
+    if (!_masterVoice)
+        return;
+    
+    /* Free the tables the audio thread has replaced. As with the voice sets, reclaiming before each publish keeps at most two waiting */
+    MidiDispatchTable *table;
+    while (_retiredMidiDispatch.pop(&table))
+        delete table;
+    
+    table = new MidiDispatchTable();
+    _masterVoice->compileMidiDispatchTable(table);
+    
+    /* A table published earlier that the audio thread hasn't taken was never read, so it can be freed right away */
+    delete _pendingMidiDispatch.exchange(table, std::memory_order_acq_rel);
+}
+
+void PolySynth::dispatchMidi(const unsigned char *bytes, int size) {
+    
+    MidiDispatchTable *table = _midiDispatch;
+    if (!table)
+        return;
+    
+    const MidiDispatchEntry *entries;
+    float position;
+    int n = table->resolve(bytes, size, &_midiParser, -1, &entries, &position);
+    if (n == 0)
+        return;
+    
+    /* Global values set before this message are stale for the parameters it sets. Voices that haven't applied them yet skip them when they're next synced, so they can't overwrite this message */
+    unsigned int version = _paramVersion.load(std::memory_order_acquire);
+    
+    /* Scale the value once per mapping, then update the same parameter slot in every voice */
+    for (int i = 0; i < n; i++) {
+        
+        float fval = MidiDispatchTable::mappedValue(entries[i], position);
+        
+        if (entries[i].parameterID >= 0 && entries[i].parameterID < _nGlobalParams)
+            _globalParams[entries[i].parameterID].midiVersion = version;
+        
+        for (int vc = 0; vc < _nVoices; vc++) {
+            
+            SynthParameter *param = _voices[vc].v->getParameterWithID(entries[i].parameterID);
+            if (!param)
+                continue;
+            
+            MidiDispatchTable::apply(entries[i], param, fval);
+            
+            if (!_voices[vc].overrides.empty())
+                clearOverride(vc, entries[i].parameterID);
+        }
+    }
 }
 
 void PolySynth::setSampleRate(float fs) {
     
     _fs = fs;
-    for (int vc = 0; vc < _nVoices; vc++) {
-        if (_voices[vc].v)
-            _voices[vc].v->setSampleRate(_fs);
-    }
+    _requestedSampleRate.store(fs);
 }
 
 void PolySynth::setNumVoices(int num) {
     
-    _nVoices = num;
+    _nRequestedVoices = num;
     
     if (_masterVoice)
         setMasterVoice(_masterVoice);
 }
 
+void PolySynth::setFilterType(BiquadFilterType type) {
+    
+    /* The master isn't rendered, so it's set here. The audio thread sets the instance voices at its next render or event call */
+    if (_masterVoice)
+        _masterVoice->setFilterType(type);
+    _requestedFilterType.store(type);
+}
+
+void PolySynth::setNumRenderThreads(int num) {
+    
+    _renderPool.setNumThreads(num);
+}
+
+void PolySynth::setVoiceStealingPolicy(VoiceStealingPolicy policy) {
+    
+    /* The audio thread re-orders the steal heap for the new policy at the next allocation */
+    _requestedStealingPolicy.store(policy);
+}
+
+void PolySynth::setSilenceThreshold(float threshold) {
+    
+    _silenceLevel.store(powf(10.0f, threshold / 20.0f));
+}
+
 bool PolySynth::isSoundingMidiNote(int midiNum) {
     
-    bool found = false;
-    for (int vc = 0; vc < _nVoices; vc++) {
-        if (_voices[vc].midiNum == midiNum && _voices[vc].priority > 0)
-            found = true;
-    }
-    return found;
+    if (midiNum < 0 || midiNum >= kPolySynth_NumMidiNotes)
+        return false;
+    
+    int vc = _noteVoices[midiNum];
+    return vc >= 0 && _voices[vc].priority > 0;
 }
 
 /* MIDI Note On handler method. Returns the index of the allocated channel so the MIDI handler can send the MRP routing message. */
 int PolySynth::noteOn(int midiNum, int midiVel) {
     
-    int vc, val;        // Loop variables
-    bool stop = false;  // Loop control flag
+    updateVoices();
+    
     int idx = -1;       // Voice index to allocate
     
     if (midiNum < 0 || midiNum > 127)
@@ -162,54 +638,52 @@ int PolySynth::noteOn(int midiNum, int midiVel) {
     if (midiVel < 1 || midiVel > 127)
         return idx;
     
-    _activeKeys.insert(midiNum);
+    if (!_keysHeld[midiNum]) {
+        _keysHeld[midiNum] = true;
+        _nKeysHeld++;
+    }
     _noteCount++;
     
-    /* Find the first free channel or lowest priority note to terminate */
-    val = _noteCount;
-    for (vc = 0; vc < _nVoices && !stop; vc++) {
-        
-        /* If we have an instance of the same MIDI note currently releasing, retrigger on the same voice */
-        if (_voices[vc].midiNum == midiNum) {
-            idx = vc;
-            stop = true;
-        }
-        
-        /* If we have a free channel, use it */
-        else if (_voices[vc].priority == 0) {
-            idx = vc;
-            stop = true;
-        }
-        
-        /* Otherwise, take the voice with the lowest priority */
-        else if (_voices[vc].priority < val) {
-            val = _voices[vc].priority;
-            idx = vc;
-        }
+    if (midiNum < 21 || midiNum > 108) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Error allocating synth voice for MIDI Note %d\n", __PRETTY_FUNCTION__, midiNum);
+        return idx;
     }
     
-    /* If we found a free voice or freed one and we have a note number in the piano range */
-    if (idx != -1 && midiNum >= 21 && midiNum <= 108) {
-        
-        /* TODO: Send to pitch bend handler from here. Recording the note on time may be necessary for pitch bending. Possibly include a timestamp as an input argument to noteOn() and noteOff() */
-        
-        /* Set the note event priority */
-        _voices[idx].priority = _noteCount;
-        _voices[idx].midiNum = midiNum;
-        
-        /* Set the fundamental and start the ADSR envelope */
-        _voices[idx].v->setF0(midiNoteToFreq(midiNum), false);
-        _voices[idx].v->beginAttack();
-        
-        /* TODO: separate list of MIDI velocity listeners */
-        _voices[idx].v->setVelocityAmplitude((float)midiVel/127.0f, false);
-        
-        printf("--- MIDI Note %d set to render on channel %d\n", midiNum, idx);
-        printf("------ f0 = %f\n", _voices[idx].v->f0());
-        _nActiveVoices++;
+    /* If we have an instance of the same MIDI note currently releasing, retrigger on the same voice. Otherwise take a free voice or steal one */
+    idx = _noteVoices[midiNum];
+    if (idx < 0)
+        idx = allocateVoice(midiNum);
+    
+    if (idx < 0) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Error allocating synth voice for MIDI Note %d\n", __PRETTY_FUNCTION__, midiNum);
+        return idx;
     }
-    else
-        printf("%s: Error allocating synth voice for MIDI Note %d\n", __PRETTY_FUNCTION__, midiNum);
+    
+    /* TODO: Send to pitch bend handler from here. Recording the note on time may be necessary for pitch bending. Possibly include a timestamp as an input argument to noteOn() and noteOff() */
+    
+    /* Set the note event priority */
+    _voices[idx].midiNum = midiNum;
+    _voices[idx].onset = _noteCount;
+    _voices[idx].released = false;
+    _noteVoices[midiNum] = idx;
+    _lastVoices[midiNum] = idx;
+    _keyStolen[midiNum] = false;
+    setVoicePriority(idx, _noteCount);
+    
+    /* Bring the voice's global parameters up to date before it starts sounding, and undo the previous note's per-note control */
+    syncVoiceParams(idx);
+    restoreOverrides(idx);
+    
+    /* Set the fundamental and start the ADSR envelope */
+    _voices[idx].v->setF0(midiNoteToFreq(midiNum), false);
+    _voices[idx].v->beginAttack();
+    
+    /* TODO: separate list of MIDI velocity listeners */
+    _voices[idx].v->setVelocityAmplitude((float)midiVel/127.0f, false);
+    
+    RealtimeLog::log(kLogLevel_Debug, "--- MIDI Note %d set to render on channel %d\n", midiNum, idx);
+    RealtimeLog::log(kLogLevel_Debug, "------ f0 = %f\n", _voices[idx].v->f0());
+    _nActiveVoices++;
     
     return idx;
 }
@@ -217,49 +691,38 @@ int PolySynth::noteOn(int midiNum, int midiVel) {
 /* MIDI Note off handler method */
 int PolySynth::noteOff(int midiNum) {
     
-    int vc = 0;
-    bool stop = false;
+    updateVoices();
+    
     int idx = -1;       // Voice index to deallocate
     
     if (midiNum < 0 || midiNum > 127)
         return idx;
     
-    _activeKeys.erase(midiNum);
+    if (_keysHeld[midiNum]) {
+        _keysHeld[midiNum] = false;
+        _nKeysHeld--;
+    }
+    _keyStolen[midiNum] = false;
     
-    /* Find this note number in the voices list */
-    while (!stop && vc < _nVoices) {
+    /* Find this note number's voice */
+    idx = _noteVoices[midiNum];
+    if (idx >= 0) {
         
-        if (midiNum == _voices[vc].midiNum) {
-            
-            _voices[vc].v->beginRelease();  // Start release envelope
-            idx = vc;
-            stop = true;
-            
-            _voices[vc].priority -= _activeKeys.size();     // Reduce priority of released notes
-            printf("--- MIDI Note %d set to release on channel %d\n", midiNum, idx);
-        }
-        vc++;
+        _voices[idx].v->beginRelease();     // Start release envelope
+        _voices[idx].released = true;
+        setVoicePriority(idx, _voices[idx].priority - _nKeysHeld);     // Reduce priority of released notes
+        RealtimeLog::log(kLogLevel_Debug, "--- MIDI Note %d set to release on channel %d\n", midiNum, idx);
     }
     
-    /* If we have more or as many keys held as synth voices, then use the freed voice to re-trigger the currently held (non-sounding) voice with the highest priority */
-    if (_activeKeys.size() >= _nVoices) {
+    /* If any held keys lost their voices, use the freed voice to re-trigger the one stolen most recently */
+    while (!_stolenKeys.empty()) {
         
-        bool skip;
+        int key = _stolenKeys.back();
+        _stolenKeys.pop_back();
         
-        /* For each currently active note (note: these are in order of arrival) */
-        for (set<int>::iterator it = _activeKeys.begin(); it != _activeKeys.end(); it++) {
-            
-            skip = false;
-            
-            /* Skip this help note if it has a voice */
-            for (int i = 0; i < _nVoices; i++) {
-                if (_voices[i].midiNum == *it)
-                    skip = true;
-            }
-            
-            /* Otherwise, re-trigger the held note */
-            if (!skip)
-                noteOn(*it, 100);
+        if (_keyStolen[key]) {
+            noteOn(key, 100);
+            break;
         }
     }
     
@@ -268,20 +731,165 @@ int PolySynth::noteOff(int midiNum) {
 
 vector<pair<string, float> > PolySynth::handleMidiControl(vector<unsigned char>* message) {
     
+    updateVoices();
+    
     /* Return a vector of parameter names and values for any parameters that were updated, allowing the Objective C MIDI handler to update UI elements */
     vector<pair<string, float> > updatedParams;
     
+    /* Per-note messages only change their note's voice */
+    if (isPerNoteMessage(message->data(), (int)message->size())) {
+        dispatchNoteMidi(noteMessageVoice(message->data(), (int)message->size()), message->data(), (int)message->size());
+        return updatedParams;
+    }
+    
     /* Set the value for the master voice and all channel voices */
     updatedParams = _masterVoice->handleMidi(message);
-    for (int i = 0; i < _nVoices; i++) {
-       _voices[i].v->handleMidi(message);
-    }
+    dispatchMidi(message->data(), (int)message->size());
+    
+    return updatedParams;
+}
+
+#pragma mark - Event Queue
+double PolySynth::hostTime() {
+    
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool PolySynth::queueEvent(const unsigned char *bytes, int size, double time) {
+    
+    MidiEvent event;
+    event.time = time;
+    event.size = std::min(size, 3);
+    memcpy(event.bytes, bytes, event.size);
+    
+    /* Several MIDI input ports may call back on different threads, so take turns pushing. The audio thread never takes this lock */
+    while (_eventQueueLock.test_and_set(std::memory_order_acquire)) ;
+    bool queued = _eventQueue.push(event);
+    _eventQueueLock.clear(std::memory_order_release);
+    
+    if (!queued)
+        RealtimeLog::log(kLogLevel_Warning, "%s: Event queue full. Dropping MIDI message %2x\n", __PRETTY_FUNCTION__, bytes[0]);
+    
+    return queued;
+}
+
+bool PolySynth::queueNoteOn(int midiNum, int midiVel) {
+    
+    unsigned char bytes[3] = { 0x90, (unsigned char)midiNum, (unsigned char)midiVel };
+    return queueEvent(bytes, 3, hostTime());
+}
+
+bool PolySynth::queueNoteOff(int midiNum) {
+    
+    unsigned char bytes[3] = { 0x80, (unsigned char)midiNum, 0 };
+    return queueEvent(bytes, 3, hostTime());
+}
+
+vector<pair<string, float> > PolySynth::queueMidiControl(vector<unsigned char>* message) {
+    
+    vector<pair<string, float> > updatedParams;
+    
+    if (message->size() < 2 || message->size() > 3)
+        return updatedParams;
+    
+    /* The master voice isn't rendered, so it can be updated from this thread. Per-note messages are left to the audio thread, which knows which voice is playing the note */
+    if (!isPerNoteMessage(message->data(), (int)message->size()))
+        updatedParams = _masterVoice->handleMidi(message);
+    queueEvent(message->data(), (int)message->size(), hostTime());
     
     return updatedParams;
 }
 
+void PolySynth::processEventQueue() {
+    
+    MidiEvent event;
+    
+    updateVoices();
+    syncActiveVoices();
+    
+    while (_eventQueue.pop(&event))
+        applyEvent(event);
+    
+    notifyVoiceAllocations();
+    applyNoteControls();
+}
+
+void PolySynth::applyEvent(const MidiEvent& event) {
+    
+    int messageType = event.bytes[0] & 0xF0;
+    
+    /* Note on. Report the allocated voice back to the MIDI handler */
+    if (messageType == 0x90 && event.size == 3 && event.bytes[2] > 0) {
+        
+        _channelNotes[event.bytes[0] & 0x0F] = event.bytes[1];
+        
+        VoiceAllocation alloc;
+        alloc.midiNum = event.bytes[1];
+        alloc.channel = noteOn(event.bytes[1], event.bytes[2]);
+        
+        if (alloc.channel >= 0 && _allocationQueue.push(alloc))
+            _allocationsQueued = true;
+    }
+    
+    /* Note off (or note on with zero velocity) */
+    else if ((messageType == 0x80 || messageType == 0x90) && event.size == 3)
+        noteOff(event.bytes[1]);
+    
+    /* Per-note control for the voice playing the message's note */
+    else if (isPerNoteMessage(event.bytes, event.size))
+        dispatchNoteMidi(noteMessageVoice(event.bytes, event.size), event.bytes, event.size);
+    
+    /* Control messages have already been applied to the master voice by queueMidiControl() */
+    else
+        dispatchMidi(event.bytes, event.size);
+}
+
+int PolySynth::eventFrame(double time, double eventTime, int nFrames) {
+    
+    /* Late events (or any events in the first block) start immediately */
+    if (_lastEventTime <= 0.0 || time <= _lastEventTime || eventTime <= _lastEventTime)
+        return 0;
+    
+    int frame = (int)((time - _lastEventTime) / (eventTime - _lastEventTime) * nFrames);
+    return std::min(frame, nFrames - 1);
+}
+
+void PolySynth::notifyVoiceAllocations() {
+    
+    if (!_allocationsQueued)
+        return;
+    
+    _allocationsQueued = false;
+    
+    VoiceAllocationListener listener = _allocationListener.load(std::memory_order_acquire);
+    if (listener)
+        listener(_allocationListenerData);
+}
+
+void PolySynth::setVoiceAllocationListener(VoiceAllocationListener listener, void *userData) {
+    
+    if (listener)
+        _allocationListenerData = userData;
+    _allocationListener.store(listener, std::memory_order_release);
+}
+
+bool PolySynth::nextVoiceAllocation(int *midiNum, int *channel) {
+    
+    VoiceAllocation alloc;
+    
+    if (!_allocationQueue.pop(&alloc))
+        return false;
+    
+    *midiNum = alloc.midiNum;
+    *channel = alloc.channel;
+    return true;
+}
+
+#pragma mark - Rendering
 float PolySynth::renderSample(int channel) {
     
+    updateVoices();
+    
     /* Make sure the channel/voice index is valid */
     if (channel < 0 || channel >= _nVoices)
         return 0.0f;
@@ -294,19 +902,383 @@ float PolySynth::renderSample(int channel) {
     if (_voices[channel].priority <= 0)
         return 0.0f;
     
+    syncVoiceParams(channel);
+    
     /* Render a single sample from the synth voice assigned to this channel.  SynthVoice::renderSample() returns 1 if the note is to continue, and 0 if the note has released. The return value modifies the voice's priority. */
     float sample = 0.0f;
     _voices[channel].priority *= _voices[channel].v->renderSample(&sample);
     
     /* If we've deactivated this voice */
-    if (_voices[channel].priority == 0) {
-        printf("--- MIDI Note %d on channel %d has ended\n", _voices[channel].midiNum, channel);
-        _voices[channel].midiNum = -1;
-    }
+    if (_voices[channel].priority == 0)
+        endVoice(channel);
     
     return sample;
 }
 
+void PolySynth::renderBlock(int channel, float *outBuffer, int nFrames) {
+    
+    updateVoices();
+    
+    /* Make sure the channel/voice index is valid, we have a voice for this channel, and the voice is active. Otherwise output silence */
+    if (channel < 0 || channel >= _nVoices || !_voices[channel].v || _voices[channel].priority <= 0) {
+        memset(outBuffer, 0, nFrames * sizeof(float));
+        return;
+    }
+    
+    DenormalFlush flush;
+    syncVoiceParams(channel);
+    
+    /* Render the whole block from the synth voice assigned to this channel. SynthVoice::renderBlock() returns 1 if the note is to continue, and 0 if the note has released. The return value modifies the voice's priority. */
+    _voices[channel].priority *= _voices[channel].v->renderBlock(outBuffer, nFrames);
+    
+    /* Finish the release early if the voice can no longer be heard */
+    if (isSilent(channel))
+        _voices[channel].priority = 0;
+    
+    /* If we've deactivated this voice */
+    if (_voices[channel].priority == 0)
+        endVoice(channel);
+}
+
+void PolySynth::renderBlock(float **outBuffers, int nChannels, int nFrames) {
+    
+    renderBlock(outBuffers, nChannels, nFrames, hostTime());
+}
+
+void PolySynth::renderBlock(float **outBuffers, int nChannels, int nFrames, double eventTime) {
+    
+    updateVoices();
+    
+    int nRender = std::min(nChannels, (int)_voices.size());
+    MidiEvent event;
+    DenormalFlush flush;
+    
+    /* Channels without voices output silence */
+    for (int ch = nRender; ch < nChannels; ch++)
+        memset(outBuffers[ch], 0, nFrames * sizeof(float));
+    
+    /* Pick up global parameter changes and continuous per-note control once per block. Voices allocated by events in this block are synced by noteOn() */
+    syncActiveVoices();
+    applyNoteControls();
+    
+    for (int offset = 0, n; offset < nFrames; offset += n) {
+        
+        /* Apply the queued events that fall on or before this frame. Events stamped after the end of this block's window stay queued for the next block */
+        int nextEvent = nFrames;
+        while (_eventQueue.peek(&event) && event.time < eventTime) {
+            
+            int frame = eventFrame(event.time, eventTime, nFrames);
+            if (frame > offset) {
+                nextEvent = frame;
+                break;
+            }
+            
+            _eventQueue.pop(&event);
+            applyEvent(event);
+        }
+        
+        /* Wake the MIDI handler before rendering so its routing messages go out with as little delay as possible */
+        notifyVoiceAllocations();
+        
+        /* Render the segment up to the next event. Inactive channels output silence */
+        n = std::min(nFrames, nextEvent) - offset;
+        
+        _activeChannels.clear();
+        for (int ch = 0; ch < nRender; ch++) {
+            if (_voices[ch].v && _voices[ch].priority > 0)
+                _activeChannels.push_back(ch);
+            else
+                memset(outBuffers[ch] + offset, 0, n * sizeof(float));
+        }
+        
+        _segmentBuffers = outBuffers;
+        _segmentOffset = offset;
+        _segmentFrames = n;
+        
+        int nGroups = ((int)_activeChannels.size() + kBiquadBank_NumLanes - 1) / kBiquadBank_NumLanes;
+        _renderPool.run(&PolySynth::renderGroupJob, this, nGroups);
+        
+        /* Free the voices that finished releasing. This modifies the allocator, so it's done here rather than by the render threads */
+        for (int i = 0; i < _activeChannels.size(); i++) {
+            if (_voices[_activeChannels[i]].priority == 0)
+                endVoice(_activeChannels[i]);
+        }
+    }
+    
+    _lastEventTime = eventTime;
+}
+
+void PolySynth::renderGroupJob(int group, void *userData) {
+    
+    ((PolySynth *)userData)->renderGroup(group);
+}
+
+void PolySynth::renderGroup(int group) {
+    
+    int first = group * kBiquadBank_NumLanes;
+    int last = std::min(first + kBiquadBank_NumLanes, (int)_activeChannels.size());
+    
+    /* This group's entries in the filter scratch lists */
+    BiquadFilter **filters = &_filters[first];
+    float **filterBuffers = &_filterBuffers[first];
+    
+    for (int offset = _segmentOffset, n; offset < _segmentOffset + _segmentFrames; offset += n) {
+        
+        n = std::min(_segmentOffset + _segmentFrames - offset, kSynthVoice_ControlBlockSize);
+        int nFilters = 0;
+        
+        for (int i = first; i < last; i++) {
+            
+            int ch = _activeChannels[i];
+            float *chOut = _segmentBuffers[ch] + offset;
+            
+            /* Voices that finished earlier in the segment output silence */
+            if (_voices[ch].priority <= 0) {
+                memset(chOut, 0, n * sizeof(float));
+                continue;
+            }
+            
+            /* Render the voice without its output filter, and collect the filter to run with the others */
+            BiquadFilter *filter;
+            _voices[ch].priority *= _voices[ch].v->renderBlockUnfiltered(chOut, n, &filter);
+            
+            /* Finish the release early if the voice can no longer be heard. It still outputs this control block, so its filter is run below */
+            if (isSilent(ch))
+                _voices[ch].priority = 0;
+            
+            if (filter) {
+                filters[nFilters] = filter;
+                filterBuffers[nFilters] = chOut;
+                nFilters++;
+            }
+        }
+        
+        _filterBank.process(filters, filterBuffers, nFilters, n);
+    }
+}
+
+void PolySynth::endVoice(int channel) {
+    
+    RealtimeLog::log(kLogLevel_Debug, "--- MIDI Note %d on channel %d has ended\n", _voices[channel].midiNum, channel);
+    
+    if (_voices[channel].midiNum >= 0)
+        _noteVoices[_voices[channel].midiNum] = -1;
+    _voices[channel].midiNum = -1;
+    
+    heapRemove(channel);
+    _voices[channel].freeIdx = (int)_freeVoices.size();
+    _freeVoices.push_back(channel);
+}
+
+#pragma mark - Voice Allocation
+void PolySynth::resetVoiceAllocation() {
+    
+    _freeVoices.clear();
+    _stealHeap.clear();
+    _stolenKeys.clear();
+    _freeVoices.reserve(_voices.size());
+    _stealHeap.reserve(_voices.size());
+    _stolenKeys.reserve(kPolySynth_NumMidiNotes);
+    
+    /* Push in reverse so the lowest channels are allocated first */
+    for (int vc = (int)_voices.size()-1; vc >= 0; vc--) {
+        _voices[vc].midiNum = -1;
+        _voices[vc].priority = 0;
+        _voices[vc].onset = 0;
+        _voices[vc].released = false;
+        _voices[vc].heapIdx = -1;
+        _voices[vc].freeIdx = (int)_freeVoices.size();
+        _freeVoices.push_back(vc);
+    }
+    
+    for (int i = 0; i < kPolySynth_NumMidiNotes; i++) {
+        _noteVoices[i] = -1;
+        _lastVoices[i] = -1;
+        _keyStolen[i] = false;
+    }
+}
+
+int PolySynth::allocateVoice(int midiNum) {
+    
+    int idx = -1;
+    
+    /* Apply a policy change. Re-order the heap for the new steal keys */
+    VoiceStealingPolicy policy = (VoiceStealingPolicy)_requestedStealingPolicy.load();
+    if (policy != _stealingPolicy) {
+        _stealingPolicy = policy;
+        for (int i = (int)_stealHeap.size()/2 - 1; i >= 0; i--)
+            heapSiftDown(i);
+    }
+    
+    /* Use a free voice if we have one, preferring the voice that last played this note if we're keeping string affinity */
+    if (!_freeVoices.empty()) {
+        
+        idx = _freeVoices.back();
+        
+        if (_stealingPolicy == kVoiceStealingPolicy_StringAffinity) {
+            int last = _lastVoices[midiNum];
+            if (last >= 0 && _voices[last].freeIdx >= 0)
+                idx = last;
+        }
+        
+        freeListRemove(idx);
+        return idx;
+    }
+    
+    if (_stealHeap.empty())
+        return idx;
+    
+    /* Otherwise steal the voice on top of the heap. Envelope levels change every sample, so the quietest voice is found with a pass over the used voices instead */
+    idx = _stealHeap[0];
+    
+    if (_stealingPolicy == kVoiceStealingPolicy_Quietest) {
+        
+        float minLevel = _voices[idx].v->envelopeLevel();
+        for (int i = 1; i < _stealHeap.size(); i++) {
+            
+            float level = _voices[_stealHeap[i]].v->envelopeLevel();
+            if (level < minLevel) {
+                minLevel = level;
+                idx = _stealHeap[i];
+            }
+        }
+    }
+    
+    int stolenNum = _voices[idx].midiNum;
+    _noteVoices[stolenNum] = -1;
+    
+    /* Remember held keys that lose their voice so noteOff() can re-trigger them. Compact the stale entries if the list is full */
+    if (_keysHeld[stolenNum] && !_keyStolen[stolenNum]) {
+        
+        if (_stolenKeys.size() == kPolySynth_NumMidiNotes) {
+            int n = 0;
+            for (int i = 0; i < _stolenKeys.size(); i++) {
+                if (_keyStolen[_stolenKeys[i]])
+                    _stolenKeys[n++] = _stolenKeys[i];
+            }
+            _stolenKeys.resize(n);
+        }
+        
+        _stolenKeys.push_back(stolenNum);
+        _keyStolen[stolenNum] = true;
+    }
+    
+    return idx;
+}
+
+void PolySynth::freeListRemove(int channel) {
+    
+    /* Move the last free voice into this one's slot */
+    int i = _voices[channel].freeIdx;
+    int last = _freeVoices.back();
+    
+    _freeVoices[i] = last;
+    _voices[last].freeIdx = i;
+    _freeVoices.pop_back();
+    _voices[channel].freeIdx = -1;
+}
+
+long long PolySynth::stealKey(int channel) {
+    
+    Voice& voice = _voices[channel];
+    
+    /* Ties on note number or release state go to the older note */
+    switch (_stealingPolicy) {
+            
+        case kVoiceStealingPolicy_Oldest:
+            return voice.onset;
+            
+        case kVoiceStealingPolicy_ReleasedFirst:
+            return ((long long)!voice.released << 32) + voice.onset;
+            
+        case kVoiceStealingPolicy_HighestNote:
+            return ((long long)(127 - voice.midiNum) << 32) + voice.onset;
+            
+        case kVoiceStealingPolicy_LowestNote:
+            return ((long long)voice.midiNum << 32) + voice.onset;
+            
+        default:
+            return voice.priority;
+    }
+}
+
+void PolySynth::setVoicePriority(int channel, int priority) {
+    
+    _voices[channel].priority = priority;
+    
+    /* The voice's note, onset, or release state may have changed too, so its steal key can move either way */
+    if (_voices[channel].heapIdx < 0)
+        heapPush(channel);
+    else {
+        heapSiftUp(_voices[channel].heapIdx);
+        heapSiftDown(_voices[channel].heapIdx);
+    }
+}
+
+void PolySynth::heapPush(int channel) {
+    
+    _voices[channel].heapIdx = (int)_stealHeap.size();
+    _stealHeap.push_back(channel);
+    heapSiftUp(_voices[channel].heapIdx);
+}
+
+void PolySynth::heapRemove(int channel) {
+    
+    int i = _voices[channel].heapIdx;
+    if (i < 0)
+        return;
+    
+    /* Move the last entry into the hole and restore the heap property from there */
+    heapSwap(i, (int)_stealHeap.size()-1);
+    _stealHeap.pop_back();
+    _voices[channel].heapIdx = -1;
+    
+    if (i < _stealHeap.size()) {
+        heapSiftUp(i);
+        heapSiftDown(_voices[_stealHeap[i]].heapIdx);
+    }
+}
+
+void PolySynth::heapSiftUp(int i) {
+    
+    while (i > 0) {
+        int parent = (i-1) / 2;
+        if (stealKey(_stealHeap[parent]) <= stealKey(_stealHeap[i]))
+            break;
+        heapSwap(i, parent);
+        i = parent;
+    }
+}
+
+void PolySynth::heapSiftDown(int i) {
+    
+    int n = (int)_stealHeap.size();
+    
+    while (true) {
+        
+        int least = i;
+        int left = 2*i + 1;
+        int right = 2*i + 2;
+        
+        if (left < n && stealKey(_stealHeap[left]) < stealKey(_stealHeap[least]))
+            least = left;
+        if (right < n && stealKey(_stealHeap[right]) < stealKey(_stealHeap[least]))
+            least = right;
+        if (least == i)
+            break;
+        
+        heapSwap(i, least);
+        i = least;
+    }
+}
+
+void PolySynth::heapSwap(int i, int j) {
+    
+    std::swap(_stealHeap[i], _stealHeap[j]);
+    _voices[_stealHeap[i]].heapIdx = i;
+    _voices[_stealHeap[j]].heapIdx = j;
+}
+
 void PolySynth::printAllVoiceParams() {
     
     printf("\n===============\n Master Voice:\n===============\n");
@@ -11,12 +11,30 @@
 
 #include <iostream>
 #include <vector>
-#include <set>
+#include <string.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
 
 //#include "MidiController.h"
 #include "SynthVoice.h"
 #include "AdditiveSynthVoice.h"
 #include "SubtractiveSynthVoice.h"
+#include "BiquadFilterBank.h"
+#include "LockFreeQueue.h"
+#include "VoiceRenderPool.h"
+#include "DenormalFlush.h"
+#include "RealtimeLog.h"
+
+#define kPolySynth_EventQueueSize 1024      // Maximum number of pending MIDI events/voice allocations (power of two)
+#define kPolySynth_RetiredVoiceSetQueueSize 4   // Replaced voice sets waiting to be freed (power of two). At most two can be waiting at once (see reclaimVoiceSets())
+#define kPolySynth_RetiredDispatchQueueSize 4   // Replaced MIDI dispatch tables waiting to be freed (power of two). At most two can be waiting at once
+#define kPolySynth_ParamRingSize 256        // Most recent global parameter changes whose IDs are kept, so syncing a voice only visits the parameters that changed (power of two)
+#define kPolySynth_NumMidiNotes 128
+#define kPolySynth_NumMidiChannels 16
+#define kPolySynth_NumNoteControls 2        // Continuous per-note sources (see setNoteControl()), e.g. TouchKeys key position and touch location
+#define kPolySynth_VoiceAlignment 64        // Byte alignment of each instance voice (one cache line)
+#define kPolySynth_DefaultSilenceThreshold -90.0f  // Level (dB) below which voices are ended early
 
 /* To Do: Poly synth should handle incoming MIDI messages in a raw format.
  
@@ -44,9 +62,52 @@
  
  */
 
+/* Rules for choosing which sounding voice to take when noteOn() finds no free voice */
+typedef enum VoiceStealingPolicy {
+    kVoiceStealingPolicy_LowestPriority = 0,    // Oldest note, with released notes aged by the number of keys held when released (default)
+    kVoiceStealingPolicy_Oldest,                // Earliest note on
+    kVoiceStealingPolicy_Quietest,              // Lowest current envelope level
+    kVoiceStealingPolicy_ReleasedFirst,         // Oldest released note, then oldest held note
+    kVoiceStealingPolicy_HighestNote,
+    kVoiceStealingPolicy_LowestNote,
+    kVoiceStealingPolicy_StringAffinity         // Reuse the free voice that last played the same note (MRP string) if possible, so the MRP doesn't re-route it; otherwise as LowestPriority
+} VoiceStealingPolicy;
+
+/* Raw MIDI message passed from the MIDI input threads to the audio thread */
+typedef struct MidiEvent {
+    double time;                // Host time (seconds) when the message was received
+    int size;                   // Number of valid bytes
+    unsigned char bytes[3];
+} MidiEvent;
+
+/* Voice allocated to a queued note on, passed from the audio thread back to the MIDI handler (e.g. for MRP routing messages) */
+typedef struct VoiceAllocation {
+    int midiNum;
+    int channel;
+} VoiceAllocation;
+
+/* Called on the audio thread when voice allocations are queued (see PolySynth::setVoiceAllocationListener()) */
+typedef void (*VoiceAllocationListener) (void *userData);
+
+/* Latest value of a master voice parameter set with PolySynth::setMasterVoiceParam(), read by the audio thread when it brings instance voices up to date */
+typedef struct GlobalParameter {
+    std::atomic<float> value;
+    std::atomic<bool> ramp;
+    std::atomic<unsigned int> version;      // Value of the PolySynth's parameter version when last set (0 if never set)
+    unsigned int midiVersion;               // Parameter version when a MIDI mapping last set the parameter on every instance voice (audio thread). Global values older than this are stale
+} GlobalParameter;
+
+/* A parameter of an instance voice changed by per-note control, and its value before the change */
+typedef struct NoteOverride {
+    int parameterID;
+    float baseValue;
+} NoteOverride;
+
 //! Abstract Base Class for Polyphonic Synthesis
 /*!
+    MIDI input threads should use the queueNoteOn(), queueNoteOff(), and queueMidiControl() methods rather than calling noteOn(), noteOff(), and handleMidiControl() directly. These push the message onto a lock-free queue that the audio thread drains during renderBlock(float**, int, int), so the voice list is only ever modified by the audio thread.
  
+    Queued events are applied on the exact sample rather than at the start of the buffer. The events stamped between the previous two calls to renderBlock() are spread over the block being rendered at the same relative positions, so rhythm is preserved at the cost of one buffer of extra latency.
 */
 class PolySynth {
     
@@ -61,14 +122,147 @@ protected:
         SynthVoice *v;          // Actual synth voice
         int midiNum;            // MIDI note number (-1) if unused
         int priority;           // Inverse priority for replacement (0 if unused)
+        int onset;              // Value of _noteCount at the voice's last noteOn()
+        bool released;          // Whether the voice's note has been released
+        int heapIdx;            // Position in _stealHeap (-1 if unused)
+        int freeIdx;            // Position in _freeVoices (-1 if used)
+        unsigned int paramVersion;  // Parameter version the voice's global parameters are up to date with
+        std::vector<NoteOverride> overrides;    // Parameters changed by per-note control since the last note on (capacity reserved for every parameter)
     } Voice;
     
-    int _nVoices;               // Number of synth voices (polyphony), or audio channels in the case of the MRP
+    int _nVoices;               // Number of synth voices (polyphony), or audio channels in the case of the MRP. Set by the audio thread when it swaps in a new voice set
+    int _nRequestedVoices;      // Polyphony set with setNumVoices(), used for the next voice set
     int _nActiveVoices;         // Number of voices currently rendering
     std::vector<Voice> _voices; // Array of voice info structs (one for each audio channel)
-    std::set<int> _activeKeys;  // MIDI note numbers of keys currently held
+    void *_voiceSlab;           // Contiguous storage for the instance voices, cloned from the master voice
     int _noteCount;             // Number of noteOn() events since object instantiation
     
+    /* Instance voices cloned from one master voice, along with the scratch lists whose size depends on the number of voices. setMasterVoice() builds a complete set on the calling thread and publishes it through _pendingVoiceSet. The audio thread swaps it with the set it's rendering at its next entry point (see updateVoices()) and passes the old set back through _retiredVoiceSets, so voices are never freed while the audio thread may be rendering them */
+    typedef struct VoiceSet {
+        std::vector<Voice> voices;
+        void *slab;
+        std::vector<BiquadFilter*> filters;
+        std::vector<float*> filterBuffers;
+        std::vector<int> activeChannels;
+        std::vector<int> freeVoices;
+        std::vector<int> stealHeap;
+        GlobalParameter *globalParams;
+        int nGlobalParams;
+    } VoiceSet;
+    
+    std::atomic<VoiceSet*> _pendingVoiceSet;        // Built by setMasterVoice(), not yet taken by the audio thread
+    LockFreeQueue<VoiceSet*, kPolySynth_RetiredVoiceSetQueueSize> _retiredVoiceSets;   // Audio thread -> thread calling setMasterVoice()
+    
+    VoiceSet* buildVoiceSet(SynthVoice *master, int nVoices);  // Clone nVoices instance voices from master. Returns NULL if the storage can't be allocated
+    static void freeVoiceSet(VoiceSet *set);
+    void reclaimVoiceSets();        // Free the voice sets the audio thread has replaced
+    void swapVoiceSet(VoiceSet *set);   // Exchange the rendered voices and their scratch lists with set's
+    
+    /* Voice settings that aren't parameters. Requested from any thread and applied to every instance voice by the audio thread */
+    std::atomic<int> _requestedFilterType;      // BiquadFilterType, or -1 if never set
+    std::atomic<float> _requestedSampleRate;
+    int _voiceFilterType;                       // Settings the instance voices currently have (audio thread). -1 if unknown
+    float _voiceSampleRate;
+    
+    /* Bring the instance voices up to date with a new voice set, MIDI dispatch table, or settings changed by other threads. Called by the audio thread at every entry point (rendering, event processing, and the direct event handlers) */
+    void updateVoices() {
+        if (_pendingVoiceSet.load(std::memory_order_relaxed) ||
+            _pendingMidiDispatch.load(std::memory_order_relaxed) ||
+            _requestedFilterType.load(std::memory_order_relaxed) != _voiceFilterType ||
+            _requestedSampleRate.load(std::memory_order_relaxed) != _voiceSampleRate)
+            applyVoiceUpdates();
+    }
+    void applyVoiceUpdates();
+    
+    /* Voice allocation. noteOn() takes a voice from the free list, or steals the lowest priority voice from the top of the heap, and noteOff() finds the voice through the note table, so neither scans the voice list */
+    std::vector<int> _freeVoices;                   // Stack of unused voice indices
+    std::vector<int> _stealHeap;                    // Indices of used voices, min-heap on stealKey()
+    int _noteVoices[kPolySynth_NumMidiNotes];       // Voice index for each MIDI note number (-1 if none)
+    int _lastVoices[kPolySynth_NumMidiNotes];       // Voice index that last played each MIDI note number (-1 if none)
+    bool _keysHeld[kPolySynth_NumMidiNotes];        // Keys currently held
+    int _nKeysHeld;
+    std::vector<int> _stolenKeys;                   // Held keys whose voices were stolen, most recent last. Entries with _keyStolen cleared are stale
+    bool _keyStolen[kPolySynth_NumMidiNotes];
+    
+    VoiceStealingPolicy _stealingPolicy;            // Policy the steal heap is ordered by
+    std::atomic<int> _requestedStealingPolicy;      // Set by setVoiceStealingPolicy() from any thread; applied at the next allocation
+    
+    std::atomic<float> _silenceLevel;       // Linear amplitude below which voices are ended early (see setSilenceThreshold())
+    bool isSilent(int channel) { return _voices[channel].v->maxRemainingLevel() < _silenceLevel.load(std::memory_order_relaxed); }
+    
+    BiquadFilterBank _filterBank;           // Runs the output filters of all voices in parallel
+    std::vector<BiquadFilter*> _filters;    // Scratch lists of filters and buffers for the filter bank (one entry per voice)
+    std::vector<float*> _filterBuffers;
+    
+    /* Multi-threaded rendering. Each segment of a block between events is rendered as one job per group of kBiquadBank_NumLanes active voices, so each group's filters still run together in the filter bank */
+    VoiceRenderPool _renderPool;
+    std::vector<int> _activeChannels;       // Channels with sounding voices in the current segment
+    float **_segmentBuffers;                // Output buffers, segment start and length for renderGroup()
+    int _segmentOffset;
+    int _segmentFrames;
+    
+    static void renderGroupJob(int group, void *userData);
+    void renderGroup(int group);            // Render the segment for one group of voices (called from any render thread)
+    
+    LockFreeQueue<MidiEvent, kPolySynth_EventQueueSize> _eventQueue;                // MIDI input threads -> audio thread
+    LockFreeQueue<VoiceAllocation, kPolySynth_EventQueueSize> _allocationQueue;     // Audio thread -> MIDI handler
+    std::atomic_flag _eventQueueLock;           // Serializes pushes from multiple MIDI input threads
+    double _lastEventTime;                      // End of the event window of the previous renderBlock() call
+    std::atomic<VoiceAllocationListener> _allocationListener;   // Called by the audio thread after it queues voice allocations
+    void *_allocationListenerData;              // Passed to _allocationListener
+    bool _allocationsQueued;                    // Set by applyEvent() when it queues an allocation, cleared when the listener is called
+    void notifyVoiceAllocations();              // Call the allocation listener if any allocations were queued since the last call (audio thread)
+    
+    void endVoice(int channel);     // Release the voice on this channel once it has finished rendering
+    
+    void resetVoiceAllocation();    // Free all voices and clear the note tables
+    int allocateVoice(int midiNum); // Take a free voice or steal one according to the stealing policy. Returns -1 if there are no voices
+    void freeListRemove(int channel);
+    void setVoicePriority(int channel, int priority);
+    long long stealKey(int channel);    // Voices with lower keys are stolen first
+    void heapPush(int channel);
+    void heapRemove(int channel);
+    void heapSiftUp(int heapIdx);
+    void heapSiftDown(int heapIdx);
+    void heapSwap(int i, int j);
+    
+    void applyEvent(const MidiEvent& event);
+    
+    /* Global parameters. setMasterVoiceParam() updates the master voice and one GlobalParameter slot (indexed by parameter ID, which is the same for the master and its clones), records the ID in _paramRing and bumps _paramVersion, rather than setting the parameter on every instance voice. The audio thread brings a voice up to date with syncVoiceParams() when it starts a note and before rendering each block (or sample) while it's sounding, visiting only the IDs changed since the voice's last sync. A slider drag costs the UI thread O(1) per change and each sounding voice O(1) per change. Idle voices aren't touched until they're allocated. Each voice set has its own slots, so they're freed along with the voices they describe */
+    GlobalParameter *_globalParams;             // Slots of the voice set being rendered (audio thread)
+    int _nGlobalParams;
+    GlobalParameter *_latestGlobalParams;       // Slots of the most recently built voice set, written by setMasterVoiceParam()
+    int _nLatestGlobalParams;
+    std::atomic<int> _paramRing[kPolySynth_ParamRingSize];     // ID of the parameter set at each version, indexed by version modulo the ring size
+    std::atomic<unsigned int> _paramVersion;
+    void syncVoiceParams(int channel);      // Apply the global parameters set since the voice was last synced (audio thread)
+    void syncActiveVoices();
+    void applyGlobalParam(int channel, int id);     // Set one parameter from its global slot unless the voice already has that value or a MIDI mapping has replaced it
+    
+    /* Per-note control. Polyphonic aftertouch, and channel messages on the per-note channels (see setPerNoteChannels()), are applied only to the voice playing the note they refer to, found through the note table. Parameters they change are restored when the voice starts its next note, unless a global change has replaced them in the meantime */
+    std::atomic<int> _perNoteChannelMask;               // Bit n set if MIDI channel n is a per-note channel
+    int _channelNotes[kPolySynth_NumMidiChannels];      // Most recent note started on each MIDI channel (-1 if none)
+    int noteMessageVoice(const unsigned char *bytes, int size);     // Voice a per-note message applies to (-1 if none)
+    void dispatchNoteMidi(int channel, const unsigned char *bytes, int size);
+    void applyNoteEntries(int channel, const MidiDispatchEntry *entries, int n, float position);
+    void clearOverride(int channel, int parameterID);
+    void restoreOverrides(int channel);
+    
+    /* Latest value of each continuous per-note source, handed to the audio thread without the event queue so dense streams can't crowd out notes. A writer only marks a note dirty when its 7-bit value changes, and the audio thread applies each dirty note once per block */
+    std::atomic<int> _noteControlChannels[kPolySynth_NumNoteControls];     // MIDI channel whose polyphonic aftertouch mappings each source uses (-1 if disabled)
+    std::atomic<int> _noteControlValues[kPolySynth_NumNoteControls][kPolySynth_NumMidiNotes];
+    std::atomic<unsigned int> _noteControlDirty[kPolySynth_NumNoteControls][kPolySynth_NumMidiNotes / 32];
+    void applyNoteControls();
+    
+    /* The master voice's MIDI mappings compiled once and shared by all instance voices, which have the same parameter IDs. Rebuilt by the thread that changes the mappings and handed over like the voice sets: the audio thread takes the pending table in updateVoices() and passes the one it replaces back through _retiredMidiDispatch, so a table is only freed once the audio thread has stopped using it */
+    MidiDispatchTable *_midiDispatch;                       // Table in use (audio thread)
+    std::atomic<MidiDispatchTable*> _pendingMidiDispatch;   // Built by rebuildMidiDispatch(), not yet taken by the audio thread
+    LockFreeQueue<MidiDispatchTable*, kPolySynth_RetiredDispatchQueueSize> _retiredMidiDispatch;  // Audio thread -> thread rebuilding the table
+    MidiControlParser _midiParser;      // 14-bit and (N)RPN state of the control messages applied by the audio thread
+    void rebuildMidiDispatch();
+    void dispatchMidi(const unsigned char *bytes, int size);    // Apply a control message to every instance voice
+    int eventFrame(double time, double eventTime, int nFrames);     // Frame of the current block an event falls on
+    
     inline float midiNoteToFreq(int midiNote) { return powf(2.0f, (midiNote-69.0f)/12.0f) * 440.0f; }
 
 public:
@@ -76,26 +270,47 @@ public:
 #pragma mark - Constructors
     PolySynth();
     PolySynth(SynthVoice *master, int numVoices);
+    virtual ~PolySynth();
     
 #pragma mark - Setters
-    /* TODO: generalize setting master voices derived from SynthVoice (virtual constructor?).
-     Perhaps a virtual SynthVoice::clone() method that can be overridden by derived classes */
+    /* Replace the instance voices with clones of master (see SynthVoice::clone()). The clones are built on the calling thread and swapped in by the audio thread at its next render or event call; the previous instance voices are destroyed by a later call to setMasterVoice() or by the destructor. The master voice is still owned by the caller. Call from one thread at a time, normally the UI thread */
     void setMasterVoice(SynthVoice *master);
-    void setMasterVoice(AdditiveSynthVoice *master);
-    void setMasterVoice(SubtractiveSynthVoice *master);
     
+    /* Set a parameter on the master voice and queue it for the instance voices (see syncVoiceParams()). Call from one thread at a time, normally the UI thread */
     bool setMasterVoiceParam(string paramName, float value, bool doRamp);
     bool addMasterVoiceMidiMapping(MidiMapping *map);
     bool removeMasterVoiceMidiMapping(MidiMapping *map);
-    void setSampleRate(float fs);
-    void setNumVoices(int num);
+    void setSampleRate(float fs);       // Applied to the instance voices by the audio thread
+    void setNumVoices(int num);         // Rebuilds the instance voices (see setMasterVoice())
+    
+    /* Set the output filter type of the master voice and, through the audio thread, of every instance voice, without rebuilding the voices. Has no effect on voices without an output filter */
+    void setFilterType(BiquadFilterType type);
+    void setVoiceStealingPolicy(VoiceStealingPolicy policy);
+    
+    /* Voices whose remaining output level (SynthVoice::maxRemainingLevel()) falls below threshold dB are ended without rendering the rest of their release, e.g. long release tails or notes played at zero amplitude. -INFINITY disables the check. Can be called from any thread */
+    void setSilenceThreshold(float threshold);
+    
+    /* Treat MIDI channels first to last (0-15) as per-note channels, e.g. 1 to 15 for an MPE lower zone or a TouchKeys controller sending one note per channel. Control change, channel pressure and pitch bend messages on these channels are applied only to the voice playing the channel's most recent note, using the mappings for the same message on the first per-note channel. Pass -1 to disable (the default). Can be called from any thread */
+    void setPerNoteChannels(int first, int last);
+    
+    /* Apply continuous per-note source (0 to kPolySynth_NumNoteControls-1) through the polyphonic aftertouch mappings of MIDI channel (0-15), or disable it with -1 (the default). Use a channel no other device sends polyphonic aftertouch on. Can be called from any thread */
+    void setNoteControlChannel(int source, int channel);
+    int noteControlChannel(int source);
+    
+    /* Number of worker threads that help the audio thread render voices in renderBlock(float**, int, int). Zero (the default) renders on the calling thread only. Not real-time safe */
+    void setNumRenderThreads(int num);
     
 #pragma mark - Getters
     SynthVoice* masterVoice() { return _masterVoice; }
     int sampleRate() { return _fs; }
-    int numVoices() { return _nVoices; }
+    int numVoices() { return _nRequestedVoices; }
+    VoiceStealingPolicy voiceStealingPolicy() { return (VoiceStealingPolicy)_requestedStealingPolicy.load(); }
+    float silenceThreshold() { return 20.0f * log10f(_silenceLevel.load()); }
     bool isSoundingMidiNote(int midiNum);
     
+    /* Whether a message is applied to a single note's voice rather than to all voices (see setPerNoteChannels()) */
+    bool isPerNoteMessage(const unsigned char *bytes, int size);
+    
 #pragma mark - Event Handlers
     /* Note: PolySynth::noteOn() and PolySynth::noteOff() do the work of enabling synth voices, setting envelope states, and setting voice frequencies from the MIDI note nubmers. Any derived class that overrides these methods should directly call PolySynth::noteOn() and PolySynth::noteOff() and do additional work before or after these calls
     */
@@ -103,9 +318,44 @@ public:
     virtual int noteOff(int midiNum);                   // Returns index of deallocated voice or -1 on failure
     vector<pair<string, float> > handleMidiControl(vector<unsigned char>* message);
     
+#pragma mark - Event Queue
+    /* Thread-safe versions of the event handlers for use by MIDI input callbacks. Return false if the message was dropped because the queue is full */
+    bool queueNoteOn(int midiNum, int midiVel);
+    bool queueNoteOff(int midiNum);
+    
+    /* Queue a raw MIDI message (at most three bytes) stamped with a time in seconds, normally hostTime() */
+    bool queueEvent(const unsigned char *bytes, int size, double time);
+    
+    /* Applies the message to the master voice immediately and returns the updated parameters for the UI (see handleMidiControl()). The instance voices are updated by the audio thread. Per-note messages only update their note's voice, so they don't change the master voice or return any parameters */
+    vector<pair<string, float> > queueMidiControl(vector<unsigned char>* message);
+    
+    /* Set a continuous per-note source's value (0-1) for the voice playing midiNote. Only the latest value of each note is kept, and it's applied at the start of the next block like polyphonic aftertouch on the source's channel (see setNoteControlChannel()). Values that don't change the 7-bit controller value are ignored. Real-time safe and callable from any thread */
+    void setNoteControl(int source, int midiNote, float value);
+    
+    /* Apply all queued events immediately. Call it before renderSample() or renderBlock(int, float*, int) if using those instead of renderBlock(float**, int, int) */
+    void processEventQueue();
+    
+    /* Get the channel allocated to the next queued note on that was applied. Returns false if there are none. Call from a single (non-audio) thread */
+    bool nextVoiceAllocation(int *midiNum, int *channel);
+    
+    /* Set a function the audio thread calls after applying a batch of events that queued at least one voice allocation, so the reader of nextVoiceAllocation() can be woken instead of polling. The listener must be real-time safe (e.g. signal a semaphore or merge into a dispatch source). Set it before the audio starts, or clear it (NULL) before changing userData */
+    void setVoiceAllocationListener(VoiceAllocationListener listener, void *userData);
+    
+    /* Seconds on the host's monotonic clock, used to timestamp queued events */
+    static double hostTime();
+    
     /* Call the SynthVoice render methods to render a single sample for any Note events with priority > 0 */
     virtual float renderSample(int channel);
     
+    /* Render a block of nFrames samples from the voice assigned to this channel into outBuffer (overwriting its contents) */
+    virtual void renderBlock(int channel, float *outBuffer, int nFrames);
+    
+    /* Render a block of nFrames samples for channels 0 to nChannels-1 into the separate buffers outBuffers[channel] (overwriting their contents). Voices are rendered in control blocks of kSynthVoice_ControlBlockSize frames, and the output filters of all voices in each control block are run together by a BiquadFilterBank */
+    virtual void renderBlock(float **outBuffers, int nChannels, int nFrames);
+    
+    /* Same as above, but with the end of this block's event window given explicitly instead of read from hostTime(). Queued events stamped between the previous call's eventTime and this one are applied at the proportional frame of the block. Use this with event times on a clock other than the host's (e.g. when rendering offline, pass the output time at the end of the block) */
+    virtual void renderBlock(float **outBuffers, int nChannels, int nFrames, double eventTime);
+    
 #pragma mark - Debug
     void printAllVoiceParams();
 };
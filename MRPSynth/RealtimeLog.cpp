@@ -0,0 +1,102 @@
+//
+//  RealtimeLog.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/28/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "RealtimeLog.h"
+
+RealtimeLog::RealtimeLog() : _level(kLogLevel_Info), _nDropped(0), _quit(false) { }
+
+RealtimeLog::~RealtimeLog() {
+    
+    /* In case the application exits without calling stop() */
+    if (_thread.joinable()) {
+        _quit = true;
+        _thread.join();
+    }
+}
+
+/* Constructed on first use rather than during static initialization. The first call takes the compiler's initialization lock, which is why start() should come before any real-time thread logs */
+RealtimeLog& RealtimeLog::instance() {
+    
+    static RealtimeLog sLog;
+    return sLog;
+}
+
+void RealtimeLog::start() {
+    
+    RealtimeLog& logger = instance();
+    
+    if (logger._thread.joinable())
+        return;
+    
+    logger._quit = false;
+    logger._thread = std::thread(&RealtimeLog::drainLoop, &logger);
+}
+
+void RealtimeLog::stop() {
+    
+    RealtimeLog& logger = instance();
+    
+    if (!logger._thread.joinable())
+        return;
+    
+    logger._quit = true;
+    logger._thread.join();
+}
+
+void RealtimeLog::log(LogLevel level, const char *format, ...) {
+    
+    RealtimeLog& logger = instance();
+    
+    if (level > logger._level.load(std::memory_order_relaxed))
+        return;
+    
+    va_list args;
+    va_start(args, format);
+    logger.push(format, args);
+    va_end(args);
+}
+
+void RealtimeLog::push(const char *format, va_list args) {
+    
+    Record record;
+    vsnprintf(record.message, kRealtimeLog_MessageSize, format, args);
+    
+    if (!_queue.push(record))
+        _nDropped++;
+}
+
+void RealtimeLog::drainLoop() {
+    
+    while (!_quit) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(kRealtimeLog_DrainInterval));
+        drain();
+    }
+    
+    /* Write anything logged while we were shutting down */
+    drain();
+}
+
+void RealtimeLog::drain() {
+    
+    Record record;
+    bool wrote = false;
+    
+    while (_queue.pop(&record)) {
+        fputs(record.message, stdout);
+        wrote = true;
+    }
+    
+    unsigned int nDropped = _nDropped.exchange(0);
+    if (nDropped > 0) {
+        printf("%s: Log queue full. Dropped %u messages\n", __PRETTY_FUNCTION__, nDropped);
+        wrote = true;
+    }
+    
+    if (wrote)
+        fflush(stdout);
+}
@@ -0,0 +1,74 @@
+//
+//  RealtimeLog.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/28/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__RealtimeLog__
+#define __MRPSynthGUI__RealtimeLog__
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#include "LockFreeQueue.h"
+
+#define kRealtimeLog_QueueSize 256          // Maximum number of pending messages (power of two)
+#define kRealtimeLog_MessageSize 160        // Maximum message length in bytes, including the terminator. Longer messages are truncated
+#define kRealtimeLog_DrainInterval 0.01     // Seconds between writes of pending messages to stdout
+
+typedef enum LogLevel {
+    kLogLevel_Error = 0,
+    kLogLevel_Warning,
+    kLogLevel_Info,
+    kLogLevel_Debug
+} LogLevel;
+
+//! Logging that's safe to call from the audio and MIDI threads
+/*!
+    RealtimeLog::log() formats a message into a fixed-size record on the caller's stack and pushes it onto a preallocated multiple-producer ring buffer (see MultiProducerQueue), so it never allocates, blocks on stdio, or waits on another thread, including other threads that are logging. A logging thread at ordinary priority writes pending messages to stdout every kRealtimeLog_DrainInterval seconds. If the ring buffer fills up, new messages are dropped and counted, and the logging thread reports how many were lost.
+
+    The log is a function-local singleton, and its thread only runs between start() and stop(), so nothing is started during static initialization. Call start() early in the application's launch, before any real-time threads exist, since that also constructs the singleton. Messages logged before start() wait in the ring buffer.
+
+    Messages above the current level (see setLevel()) are discarded before they're formatted, so disabled debug messages cost a single comparison. The level defaults to kLogLevel_Info and can be changed from any thread.
+*/
+class RealtimeLog {
+    
+    struct Record {
+        char message[kRealtimeLog_MessageSize];
+    };
+    
+    MultiProducerQueue<Record, kRealtimeLog_QueueSize> _queue;
+    std::atomic<int> _level;
+    std::atomic<unsigned int> _nDropped;    // Messages lost to a full queue since the last drain
+    
+    std::thread _thread;
+    std::atomic<bool> _quit;
+    
+    RealtimeLog();
+    ~RealtimeLog();
+    
+    void drainLoop();
+    void drain();                           // Write all pending messages to stdout (logging thread only)
+    void push(const char *format, va_list args);
+    
+    static RealtimeLog& instance();
+    
+public:
+    
+    /* Start and stop the logging thread. stop() writes any pending messages before returning. Not real-time safe; call from the main thread */
+    static void start();
+    static void stop();
+    
+    /* Log a printf-style message if level is at or below the current level. Real-time safe once start() has been called */
+    static void log(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+    
+    static void setLevel(LogLevel level) { instance()._level.store(level); }
+    static LogLevel level() { return (LogLevel)instance()._level.load(); }
+};
+
+#endif /* defined(__MRPSynthGUI__RealtimeLog__) */
@@ -0,0 +1,101 @@
+//
+//  Semaphore.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/31/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__Semaphore__
+#define __MRPSynthGUI__Semaphore__
+
+#include <atomic>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/semaphore.h>
+#else
+#include <semaphore.h>
+#include <errno.h>
+#endif
+
+//! Counting semaphore for waking threads from the audio callback
+/*!
+    The count is kept in an atomic, and the kernel semaphore is only used when a thread actually has to sleep or be woken. signal() never takes a lock: with nobody waiting it's a single atomic add, and otherwise one kernel signal per woken thread (a Mach semaphore on macOS, a POSIX semaphore elsewhere), which doesn't block. A condition variable needs its mutex to be held around the notify to avoid lost wakeups, which can leave the audio thread waiting on a lower priority thread.
+*/
+class Semaphore {
+    
+    std::atomic<int> _count;        // Available tokens, or minus the number of threads waiting in the kernel
+    
+#if defined(__APPLE__)
+    semaphore_t _semaphore;
+#else
+    sem_t _semaphore;
+#endif
+    
+    void kernelSignal() {
+#if defined(__APPLE__)
+        semaphore_signal(_semaphore);
+#else
+        sem_post(&_semaphore);
+#endif
+    }
+    
+    void kernelWait() {
+#if defined(__APPLE__)
+        while (semaphore_wait(_semaphore) == KERN_ABORTED) ;
+#else
+        while (sem_wait(&_semaphore) != 0 && errno == EINTR) ;
+#endif
+    }
+    
+    Semaphore(const Semaphore&);
+    Semaphore& operator=(const Semaphore&);
+    
+public:
+    
+    Semaphore() : _count(0) {
+#if defined(__APPLE__)
+        semaphore_create(mach_task_self(), &_semaphore, SYNC_POLICY_FIFO, 0);
+#else
+        sem_init(&_semaphore, 0, 0);
+#endif
+    }
+    
+    ~Semaphore() {
+#if defined(__APPLE__)
+        semaphore_destroy(mach_task_self(), _semaphore);
+#else
+        sem_destroy(&_semaphore);
+#endif
+    }
+    
+    /* Add count tokens, waking up to count waiting threads. Real-time safe */
+    void signal(int count = 1) {
+        
+        int old = _count.fetch_add(count, std::memory_order_release);
+        int nWaiting = old < 0 ? -old : 0;
+        for (int i = 0; i < nWaiting && i < count; i++)
+            kernelSignal();
+    }
+    
+    /* Take a token, sleeping until one is available */
+    void wait() {
+        
+        if (_count.fetch_sub(1, std::memory_order_acquire) < 1)
+            kernelWait();
+    }
+    
+    /* Take a token if one is available without sleeping */
+    bool tryWait() {
+        
+        int count = _count.load(std::memory_order_relaxed);
+        while (count > 0) {
+            if (_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif /* defined(__MRPSynthGUI__Semaphore__) */
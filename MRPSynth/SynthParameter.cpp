@@ -6,8 +6,14 @@
 //  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
 //
 
+#include <limits>
+
 #include "SynthParameter.h"
 
+/* Current allocation arena for this thread (see SynthParameter::setAllocationArena()) */
+static __thread char *arenaNext = NULL;
+static __thread char *arenaEnd = NULL;
+
 #pragma mark - Constructors
 SynthParameter::SynthParameter() : _name("None"), _fs(44100.0f), _value(0.0f), _rampDuration(0.1f), _targetValue(0.0f), _valueStep(0.0f), _maxValue(std::numeric_limits<float>::max()), _minValue(std::numeric_limits<float>::min()), _parameterChangeListener(nullptr), _parameterChangeListenerUserData(nullptr), _hasParameterChangeListener(false) { }
 
@@ -25,7 +31,7 @@ void SynthParameter::namePrepend(std::string prefix) {
 void SynthParameter::setSampleRate(const float fs) {
     
     _fs = fs;
-    _valueStep = (_targetValue - _value) / (_rampDuration * _fs);
+    computeValueStep();
 }
 
 void SynthParameter::setValue(const float value) {
@@ -33,7 +39,7 @@ void SynthParameter::setValue(const float value) {
     _targetValue = value;
     _targetValue = std::min(_targetValue, _maxValue);
     _targetValue = std::max(_targetValue, _minValue);
-    _valueStep = (_targetValue - _value) / (_rampDuration * _fs);
+    computeValueStep();
 }
 
 void SynthParameter::setValue(const SynthParameter param) {
@@ -41,13 +47,28 @@ void SynthParameter::setValue(const SynthParameter param) {
     _targetValue = param.value();
     _targetValue = std::min(_targetValue, _maxValue);
     _targetValue = std::max(_targetValue, _minValue);
-    _valueStep = (_targetValue - _value) / (_rampDuration * _fs);
+    computeValueStep();
 }
 
 void SynthParameter::setRampDuration(const float rampDuration) {
     
     _rampDuration = rampDuration;
-    _valueStep = (_targetValue - _value) / (_rampDuration * _fs);
+    computeValueStep();
+}
+
+void SynthParameter::computeValueStep() {
+    
+    float rampSamples = _rampDuration * _fs;
+    
+    if (_targetValue == _value)
+        _valueStep = 0.0f;
+    
+    /* Ramps shorter than a sample reach the target on the next update */
+    else if (rampSamples < 1.0f)
+        _valueStep = _targetValue - _value;
+    
+    else
+        _valueStep = (_targetValue - _value) / rampSamples;
 }
 
 void SynthParameter::setRange(float minVal, float maxVal) {
@@ -85,10 +106,19 @@ void SynthParameter::removeParameterChangeListener() {
 }
 
 #pragma mark - Updates
-void SynthParameter::ramp() {
+void SynthParameter::ramp(int nSamples) {
     
-    if ((_valueStep > 0 && _value < _targetValue) || (_valueStep < 0 && _value > _targetValue))
-        _value += _valueStep;
+    /* Skip parameters that have reached their target */
+    if (_valueStep == 0.0f || nSamples <= 0)
+        return;
+    
+    _value += _valueStep * nSamples;
+    
+    /* Stop on the target value once we reach or pass it */
+    if ((_valueStep > 0.0f && _value >= _targetValue) || (_valueStep < 0.0f && _value <= _targetValue)) {
+        _value = _targetValue;
+        _valueStep = 0.0f;
+    }
     
     /* Notify the parameter listener if it exists */
     if (_hasParameterChangeListener) {
@@ -97,23 +127,44 @@ void SynthParameter::ramp() {
     }
 }
 
-void SynthParameter::ramp(int nSamples) {
+#pragma mark - Allocation
+void SynthParameter::setAllocationArena(void *mem, size_t size) {
+    
+    arenaNext = (char *)mem;
+    arenaEnd = arenaNext + size;
+}
+
+void SynthParameter::clearAllocationArena() {
+    
+    arenaNext = arenaEnd = NULL;
+}
+
+void* SynthParameter::operator new(size_t size) {
     
-    float modStep = _valueStep * nSamples;
-    
-    if ((modStep > 0.0f && _value < _targetValue) || (modStep < 0.0f && _value < _targetValue)) {
-        
-        _value += modStep;
-        
-        /* Notify the parameter listener if it exists */
-        if (_hasParameterChangeListener) {
-            ParameterChangeListener callback = (ParameterChangeListener)_parameterChangeListener;
-            callback(_targetValue, _parameterChangeListenerUserData);
-        }
+    size_t total = kSynthParameter_AllocHeaderSize + ((size + 15) & ~(size_t)15);
+    char *block;
+    bool inArena = arenaNext && arenaNext + total <= arenaEnd;
+    
+    if (inArena) {
+        block = arenaNext;
+        arenaNext += total;
     }
+    else if (!(block = (char *)malloc(total)))
+        throw std::bad_alloc();
     
-    else
+    /* Mark where the parameter came from so delete knows whether to free it */
+    *(bool *)block = inArena;
+    return block + kSynthParameter_AllocHeaderSize;
+}
+
+void SynthParameter::operator delete(void *ptr) {
+    
+    if (!ptr)
         return;
+    
+    char *block = (char *)ptr - kSynthParameter_AllocHeaderSize;
+    if (!*(bool *)block)
+        free(block);
 }
 
 #pragma mark - Overloaded Operators (Members)
@@ -10,11 +10,17 @@
 #define __MRP__SynthParameter__
 
 #include <iostream>
+#include <new>
+#include <stdlib.h>
+
+#define kSynthParameter_AllocHeaderSize 16      // Bytes before each parameter allocated with new, marking where it came from
 
 //! Ramped Synth Parameter
 /*!
     Used for synth prameters that shouldn't change in noticably discrete intervals (i.e. from infrequent parameter updates via a laggy UI or OSC messages). Setting target parameter values with the SynthParamter::setValue() method allows parameters to be ramped linearly over a specified duration until they reach the target value by calling SynthParameter::ramp() to increment/decrement the value for a single audio sample, or SynthParameter::ramp(int nSamples) to ramp for a specified number of samples. 
  
+    Ramps stop exactly on the target value. Parameters that aren't ramping (isRamping() returns false) are skipped by both ramp() methods without notifying the parameter change listener, so idle parameters cost a single comparison per update. Block renderers can ramp at control rate by calling ramp(nSamples) once per block and interpolating linearly between the values before and after the call, which matches the per-sample ramp exactly except for the block in which the target is reached.
+ 
     Values may be set directly (without ramping) using overloaded operators {=, +=, -=, *=, /=}  with a left-hand operand of type SynthParameter, and right-hand operands of type SynthParameter or native float.
  
     Parameter values can be constrained by calling SynthParameter::setRange(float minVal, float maxVal). Attempting to set a value larger than the max will set the value to the max. Attempting to set a value smaller than the min will set the value to the min. No warning messages are generated by attempting to set outside the range. By default the range is set to the min and max representable by a float type.
@@ -23,6 +29,8 @@
  
     Boolean comparison operators {==, !=, <, >, <=, >=} are also implemented for SynthParameter types on both left- and right-hand sides, or a SynthParameter type and a native float type on either side.
  
+    Parameters created with new are placed in the current allocation arena if one is set with setAllocationArena(), and on the heap otherwise. PolySynth uses this to put each instance voice's parameters in the same contiguous block as the voice. Arena memory is reclaimed all at once by its owner, so delete only frees parameters that were allocated on the heap (including any that didn't fit in the arena).
+ 
     To do: logarithmic ramping.
 */
 class SynthParameter {
@@ -45,6 +53,8 @@ class SynthParameter {
     void *_parameterChangeListenerUserData;
     bool _hasParameterChangeListener;
     
+    void computeValueStep();        // Recompute _valueStep for the current target, ramp duration, and sample rate
+    
 public:
     
 #pragma mark - Constructors/Desctructors
@@ -56,6 +66,8 @@ public:
     std::string name() { return _name; }
     float sampleRate() const { return _fs; }                  // Get the sampling rate
     float value() const { return _value; }                    // Query the current value
+    float targetValue() const { return _targetValue; }        // Query the value we're ramping to
+    bool isRamping() const { return _valueStep != 0.0f; }     // Whether the value is still moving toward the target
     float minVal() const { return _minValue; }
     float maxVal() const { return _maxValue; }
     
@@ -71,8 +83,17 @@ public:
     void removeParameterChangeListener();
     
 #pragma mark - Updates
-    void ramp();                            // Update if _value != _targetValue (single sample)
-    void ramp(int nSamples);                // Update if _value != _targetValue (multiple samples)
+    void ramp() { if (_valueStep != 0.0f) ramp(1); }    // Update if _value != _targetValue (single sample)
+    void ramp(int nSamples);                            // Update if _value != _targetValue (multiple samples)
+    
+#pragma mark - Allocation
+    /* Place parameters created with new on this thread in the size bytes at mem until clearAllocationArena() is called */
+    static void setAllocationArena(void *mem, size_t size);
+    static void clearAllocationArena();
+    static size_t allocationSize() { return kSynthParameter_AllocHeaderSize + ((sizeof(SynthParameter) + 15) & ~(size_t)15); }     // Arena bytes used per parameter
+    
+    static void* operator new(size_t size);
+    static void operator delete(void *ptr);
     
 #pragma mark - Overloaded Operators (Members)
     SynthParameter& operator=(const float value);
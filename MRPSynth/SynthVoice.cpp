@@ -154,26 +154,49 @@ void SynthVoice::beginRelease() {
     _adsr.beginRelease();
 }
 
-void SynthVoice::sampleUpdate() {
+int SynthVoice::renderBlock(float *outBuffer, int nFrames) {
+    
+    int cont = 1;
+    int i = 0;
+    
+    while (i < nFrames && cont) {
+        
+        int n = std::min(nFrames - i, kSynthVoice_ControlBlockSize);
+        
+        /* Ramp parameters once for the control block and interpolate f0 and amplitude per sample */
+        float f0 = _f0->value();
+        float amp = _amp->value();
+        controlUpdate(n);
+        float f0Step = (_f0->value() - f0) / n;
+        float ampStep = (_amp->value() - amp) / n;
+        
+        /* Envelope amplitudes for the whole control block */
+        float gain[kSynthVoice_ControlBlockSize];
+        cont = _adsr.update(gain, n);
+        
+        for (int j = 0; j < n; j++, i++) {
+            
+            f0 += f0Step;
+            amp += ampStep;
+            phaseUpdate(f0);
+            
+            outBuffer[i] = sinf(_theta) * gain[j] * _velAmp->value() * amp;
+        }
+    }
     
-    parameterListRamp();        // Ramp any parameters in the parameter list
+    /* Zero anything left over after the note ended */
+    for (; i < nFrames; i++)
+        outBuffer[i] = 0.0f;
     
-    _thetaStep = M_2PI * _f0->value() / _fs;    // Recomputer the phase increment
-    _theta += _thetaStep;                       // Update the phase
-    if (_theta >= M_2PI)                        // Wrap to interval [0, 2*pi]
-        _theta -= M_2PI;
+    return cont;
 }
 
+void SynthVoice::sampleUpdate() {
+    
+    parameterListRamp();        // Ramp any parameters in the parameter list
+    phaseUpdate(_f0->value());  // Update the phase
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
+void SynthVoice::controlUpdate(int nSamples) {
+    parameterListRamp(nSamples);    // Ramp any parameters in the parameter list for the whole control block
+}
@@ -10,8 +10,11 @@
 #define __MRP__SynthVoice__
 
 #include <iostream>
+#include <new>
+#include <algorithm>
 #include "ParameterList.h"
 #include "ADSREnvelope.h"
+#include "BiquadFilter.h"
 
 #define M_2PI 6.283185307f
 #define kSynthVoice_Default_fs 44100.0f
@@ -21,6 +24,8 @@
 #define kSynthVoice_Default_Dec 0.05f
 #define kSynthVoice_Default_Sus 1.00f
 #define kSynthVoice_Default_Rel 0.05f
+#define kSynthVoice_ControlBlockSize 32     // Frames per parameter update in renderBlock()
+#define kSynthVoice_NumUnlistedParameters 1 // Parameters created with new but not added to the parameter list (_velAmp)
 
 //! Base Class for Single (monophonic) Synth Tones
 /*!
@@ -53,11 +58,26 @@ public:
     SynthVoice();
     SynthVoice(float fs);
     SynthVoice(const SynthVoice* master);
-    ~SynthVoice();
+    virtual ~SynthVoice();
+    
+    /* Construct a copy of this voice, including its derived type, in the memory at mem (at least cloneSize() bytes). Subclasses override both methods with their own type. Destroy clones by calling the destructor directly rather than with delete */
+    virtual SynthVoice* clone(void *mem) const { return new (mem) SynthVoice(this); }
+    virtual size_t cloneSize() const { return sizeof(SynthVoice); }
+    
+    /* Arena bytes needed for the SynthParameters a clone of this voice creates (see SynthParameter::setAllocationArena()) */
+    size_t parameterStorageSize() { return (numParameters() + kSynthVoice_NumUnlistedParameters) * SynthParameter::allocationSize(); }
     
     float sampleRate() { return _fs; }      // Get the sampling rate
     float f0() { return _f0->value(); }     // Query the current fundamental freq
     
+    /* Current envelope level scaled by the velocity amplitude. Non-virtual so PolySynth can compare voice levels cheaply when choosing a voice to steal */
+    float envelopeLevel() { return _adsr.currentAmplitude() * _velAmp->value(); }
+    
+    /* Upper bound on the envelope, velocity, and amplitude scaling of the voice's output until its next beginAttack(). PolySynth ends voices once this falls below its silence threshold */
+    float maxRemainingLevel() {
+        return _adsr.maxRemainingAmplitude() * std::max(_velAmp->value(), _velAmp->targetValue()) * std::max(_amp->value(), _amp->targetValue());
+    }
+    
     void setSampleRate(float fs);           // Set the sampling rate
     
     void setVelocityAmplitude(float amp, bool doRamp);
@@ -69,10 +89,25 @@ public:
     void setSustain(float sus, bool doRamp);
     void setRelease(float rel, bool doRamp);
     
+    /* Set the type of the voice's output filter, if it has one */
+    virtual void setFilterType(BiquadFilterType type) { }
+    
+    /* Called by OfflineRenderer before and after a render. Voices that hand work to helper threads can do it inline while rendering offline, so the output doesn't depend on timing */
+    virtual void setOfflineRendering(bool offline) { }
+    
     void beginAttack();         // Enable the note and reset its envelope to attack
     void beginRelease();        // Set the envelope to release
     
     void sampleUpdate();                // Update internal parameter ramps for a single sample
+    void controlUpdate(int nSamples);   // Update internal parameter ramps for a control block of nSamples
+    
+    /* Advance the phase by one sample at fundamental frequency f0 */
+    void phaseUpdate(float f0) {
+        _thetaStep = M_2PI * f0 / _fs;      // Recompute the phase increment
+        _theta += _thetaStep;               // Update the phase
+        if (_theta >= M_2PI)                // Wrap to interval [0, 2*pi]
+            _theta -= M_2PI;
+    }
     
     /* Template for SynthVoice subclass render methods */
     virtual int renderSample(float *outSample) {
@@ -93,6 +128,15 @@ public:
         /* Update the ADSR envelope for the entire buffer. The ADSR envelope update() method returns 0 when we've exceeded the release time. This tells the PolySynth that calls SynthVoice::render() that we're finished rendering. Voices that inherit from SynthVoice should ALWAYS return _adsr.update() or the PolySynth's note priority system won't work properly and PolySynth will keep wastefully calling the Voice's render method after it has released. */
         return _adsr.update();
     }
+    
+    /* Render a block of nFrames samples into outBuffer (overwriting its contents). Returns 1 if the note is to continue, or 0 if it finished releasing within the block, in which case the remaining samples are zero. Parameters are ramped at control rate, once per kSynthVoice_ControlBlockSize frames with controlUpdate(), and values used per sample are interpolated linearly within each control block. Subclasses should override this with the equivalent of their own renderSample() */
+    virtual int renderBlock(float *outBuffer, int nFrames);
+    
+    /* Render a block like renderBlock(), but leave the voice's output filter (if it has one) to the caller. Voices with an output filter set *filter to it so PolySynth can run the filters of all voices in parallel with a BiquadFilterBank; other voices render normally and set *filter to nullptr. nFrames should be at most kSynthVoice_ControlBlockSize */
+    virtual int renderBlockUnfiltered(float *outBuffer, int nFrames, BiquadFilter **filter) {
+        *filter = nullptr;
+        return renderBlock(outBuffer, nFrames);
+    }
 };
 
 #endif /* defined(__MRP__SynthVoice__) */
@@ -0,0 +1,169 @@
+//
+//  VoiceRenderPool.cpp
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/26/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#include "VoiceRenderPool.h"
+
+VoiceRenderPool::VoiceRenderPool() : _job(NULL), _userData(NULL), _nJobs(0), _nextJob(0), _running(false), _busyWorkers(0), _generation(0), _quit(false), _sleepingWorkers(0), _waiting(false) { }
+
+VoiceRenderPool::~VoiceRenderPool() {
+    
+    setNumThreads(0);
+}
+
+void VoiceRenderPool::setNumThreads(int numThreads) {
+    
+    /* Stop the existing workers. Signal once per worker, whether it's sleeping yet or not, so none can go to sleep for good */
+    _quit = true;
+    _wake.signal((int)_threads.size());
+    for (int i = 0; i < _threads.size(); i++)
+        _threads[i].join();
+    _threads.clear();
+    while (_wake.tryWait()) ;
+    _quit = false;
+    
+    for (int i = 0; i < numThreads; i++) {
+        _threads.push_back(std::thread(&VoiceRenderPool::workerLoop, this, i));
+        pinThread(_threads.back(), i);
+        setRealtimePriority(_threads.back());
+    }
+}
+
+void VoiceRenderPool::run(JobFunction job, void *userData, int nJobs) {
+    
+    if (nJobs <= 0)
+        return;
+    
+    /* Run small job sets (or everything, without workers) on this thread */
+    if (nJobs == 1 || _threads.empty()) {
+        for (int i = 0; i < nJobs; i++)
+            job(i, userData);
+        return;
+    }
+    
+    /* Publish the job set, then wake as many sleeping workers as there are jobs for them. Workers count themselves as sleeping before their last check for a new job set, so each either is counted here or sees the new set */
+    _job = job;
+    _userData = userData;
+    _nJobs = nJobs;
+    _nextJob = 0;
+    _running = true;
+    _generation++;
+    
+    int nWake = std::min(_sleepingWorkers.load(), nJobs - 1);
+    if (nWake > 0)
+        _wake.signal(nWake);
+    
+    runJobs();
+    
+    /* Every job has been claimed, so late workers have nothing left to do. Keep them out of the job set, then wait for the workers still running the jobs they claimed */
+    _running = false;
+    waitForWorkers();
+}
+
+void VoiceRenderPool::runJobs() {
+    
+    int i;
+    while ((i = _nextJob.fetch_add(1)) < _nJobs)
+        _job(i, _userData);
+}
+
+void VoiceRenderPool::waitForWorkers() {
+    
+    /* The remaining jobs are already running on other cores, so they usually finish within a short spin */
+    int spins = 0;
+    while (_busyWorkers.load() > 0 && spins < kVoiceRenderPool_SpinIterations)
+        spins++;
+    
+    if (_busyWorkers.load() == 0)
+        return;
+    
+    /* Sleep until the last busy worker leaves. Setting _waiting before checking again means it either sees the flag and signals, or we see it gone */
+    _waiting = true;
+    while (_busyWorkers.load() > 0)
+        _done.wait();
+    _waiting = false;
+    
+    /* Discard signals from workers that left after we stopped waiting */
+    while (_done.tryWait()) ;
+}
+
+void VoiceRenderPool::workerLoop(int index) {
+    
+    DenormalFlush flush;        // Workers only render audio, so flush denormals for the thread's lifetime
+    unsigned int seen = _generation.load();
+    
+    while (!_quit) {
+        
+        /* Poll briefly for the next job set, then sleep until run() signals us */
+        int spins = 0;
+        while (_generation.load() == seen && !_quit && spins < kVoiceRenderPool_SpinIterations)
+            spins++;
+        
+        if (_generation.load() == seen && !_quit) {
+            _sleepingWorkers++;
+            if (_generation.load() == seen && !_quit)
+                _wake.wait();
+            _sleepingWorkers--;
+        }
+        
+        if (_generation.load() == seen)
+            continue;
+        seen = _generation.load();
+        
+        /* Announce ourselves before touching the job set. If run() has already claimed every job, back off. The last worker out wakes run() if it's sleeping */
+        _busyWorkers++;
+        if (_running)
+            runJobs();
+        if (--_busyWorkers == 0 && _waiting)
+            _done.signal();
+    }
+}
+
+void VoiceRenderPool::pinThread(std::thread& thread, int index) {
+
+#if defined(__APPLE__)
+    /* macOS doesn't allow binding to a specific core, but threads with different affinity tags are placed on different cores where possible */
+    thread_affinity_policy_data_t policy = { index + 1 };
+    thread_policy_set(pthread_mach_thread_np(thread.native_handle()), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT);
+    
+#elif defined(__linux__)
+    /* Leave core 0 to the audio callback thread */
+    unsigned int nCores = std::thread::hardware_concurrency();
+    if (nCores > 1) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(1 + index % (nCores - 1), &cpus);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpus);
+    }
+#endif
+}
+
+void VoiceRenderPool::setRealtimePriority(std::thread& thread) {
+
+#if defined(__APPLE__)
+    /* The same policy Core Audio uses for its I/O thread, so the scheduler doesn't preempt a worker for ordinary threads while the audio thread waits on it */
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    double ticksPerSecond = 1e9 * timebase.denom / timebase.numer;
+    
+    thread_time_constraint_policy_data_t policy;
+    policy.period = 0;
+    policy.computation = (uint32_t)(kVoiceRenderPool_Computation * ticksPerSecond);
+    policy.constraint = (uint32_t)(kVoiceRenderPool_Constraint * ticksPerSecond);
+    policy.preemptible = 1;
+    
+    if (thread_policy_set(pthread_mach_thread_np(thread.native_handle()), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t)&policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT) != KERN_SUCCESS)
+        printf("%s: Error setting time constraint policy on render thread\n", __PRETTY_FUNCTION__);
+
+#elif defined(__linux__)
+    /* Needs CAP_SYS_NICE or an rtprio limit. Without it the workers still run, just at normal priority */
+    sched_param param;
+    param.sched_priority = kVoiceRenderPool_FifoPriority;
+    if (pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) != 0)
+        printf("%s: Unable to set real-time priority on render thread\n", __PRETTY_FUNCTION__);
+#endif
+}
@@ -0,0 +1,86 @@
+//
+//  VoiceRenderPool.h
+//  MRPSynthGUI
+//
+//  Created by Jeff Gregorio on 10/26/14.
+//  Copyright (c) 2014 Jeff Gregorio. All rights reserved.
+//
+
+#ifndef __MRPSynthGUI__VoiceRenderPool__
+#define __MRPSynthGUI__VoiceRenderPool__
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "DenormalFlush.h"
+#include "Semaphore.h"
+
+#if defined(__APPLE__)
+#include <pthread.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define kVoiceRenderPool_SpinIterations 20000   // Polls before a worker goes back to sleep, or before run() sleeps until the workers finish
+#define kVoiceRenderPool_Computation 0.0005     // Seconds of CPU time a worker needs per job set (macOS time constraint policy)
+#define kVoiceRenderPool_Constraint 0.001       // Seconds within which it needs them
+#define kVoiceRenderPool_FifoPriority 70        // SCHED_FIFO priority of the workers (Linux), below a typical JACK/ALSA callback thread
+
+//! Worker threads for rendering synth voices in parallel
+/*!
+    run() splits a set of independent jobs (e.g. groups of voices to render for one segment of an audio block) between the calling thread and the workers. Jobs are claimed one at a time from a shared atomic counter, so threads that finish early take the remaining jobs from threads stuck with expensive ones.
+
+    The calling thread claims jobs itself until none are left, so it only ever waits for jobs a worker has already started. It spins for a bounded time for those, then sleeps on a semaphore the last worker to finish signals, rather than burning its core. Workers are woken with a lock-free semaphore, never a condition variable, so run() is safe to call from the audio callback: a worker that misses its wakeup only costs parallelism, not correctness. run() returns once every job has finished and no worker is still touching the job set. It isn't reentrant and should only be called from one thread.
+
+    Workers run with real-time priority (the time constraint policy on macOS, SCHED_FIFO on Linux), so the audio thread isn't left waiting on a job that was preempted by an ordinary thread. Each worker is given a different affinity tag (macOS) or pinned to its own core (Linux) so the workers spread across cores. Workers run with denormals flushed to zero (see DenormalFlush).
+*/
+class VoiceRenderPool {
+
+public:
+    
+    typedef void (*JobFunction)(int job, void *userData);
+    
+    VoiceRenderPool();
+    ~VoiceRenderPool();
+    
+    /* Start numThreads worker threads, stopping any existing ones. With zero workers run() executes every job on the calling thread. Not real-time safe */
+    void setNumThreads(int numThreads);
+    int numThreads() { return (int)_threads.size(); }
+    
+    /* Call job(i, userData) for i = 0 to nJobs-1 across the calling thread and the workers, returning when all have finished */
+    void run(JobFunction job, void *userData, int nJobs);
+
+private:
+    
+    std::vector<std::thread> _threads;
+    
+    JobFunction _job;                   // Current job set
+    void *_userData;
+    int _nJobs;
+    
+    std::atomic<int> _nextJob;          // Index of the next unclaimed job
+    std::atomic<bool> _running;         // Whether a job set has unclaimed jobs
+    std::atomic<int> _busyWorkers;      // Workers currently claiming or running jobs
+    std::atomic<unsigned int> _generation;  // Incremented for each job set to wake the workers
+    std::atomic<bool> _quit;
+    
+    std::atomic<int> _sleepingWorkers;  // Workers waiting on _wake
+    Semaphore _wake;                    // Signalled by run() for each sleeping worker
+    std::atomic<bool> _waiting;         // Whether run() is (about to be) sleeping on _done
+    Semaphore _done;                    // Signalled by the last busy worker to leave a job set
+    
+    void workerLoop(int index);
+    void runJobs();                     // Claim and run jobs until none are left
+    void waitForWorkers();              // Wait until no worker is busy (calling thread)
+    static void pinThread(std::thread& thread, int index);
+    static void setRealtimePriority(std::thread& thread);
+};
+
+#endif /* defined(__MRPSynthGUI__VoiceRenderPool__) */
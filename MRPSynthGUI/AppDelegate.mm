@@ -13,6 +13,9 @@
 @synthesize window;
 
 - (void)applicationDidFinishLaunching:(NSNotification *)aNotification {
+    
+    /* Start the log's writer thread before the audio, MIDI and render threads that log through it */
+    RealtimeLog::start();
 
     /* ------------------- */
     /* === Synth Voices == */
@@ -32,6 +35,7 @@
     /* ------------------- */
     
     synth = new PolySynth();
+    synth->setNumRenderThreads(std::max((int)std::thread::hardware_concurrency() - 1, 0));  // Leave a core for the audio callback
     audioController = new AudioController(synth);
     [self setSynthVoice:self];
     
@@ -176,6 +180,8 @@
 //        delete masterVoice;
     if (synth)
         delete synth;
+    
+    RealtimeLog::stop();
 }
 
 @end
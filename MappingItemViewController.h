@@ -26,6 +26,8 @@
     IBOutlet NSTextField *maxField;
     IBOutlet NSButton *rampSwitch;
     IBOutlet NSPopUpButton *mappingScaleSelector;
+    IBOutlet NSTextField *parameterNumberField;
+    IBOutlet NSButton *highResolutionSwitch;
 }
 
 @property CALayer *bgLayer;
@@ -43,6 +45,8 @@
 - (IBAction)maxSet:(id)sender;
 - (IBAction)rampSet:(id)sender;
 - (IBAction)mappingScaleSelected:(id)sender;
+- (IBAction)parameterNumberSet:(id)sender;
+- (IBAction)highResolutionSet:(id)sender;
 
 - (void)fillMIDIParams:(std::vector<unsigned char> *)message;
 
@@ -30,6 +30,8 @@
         mapping->min = param->minVal();
         mapping->max = param->maxVal();
         mapping->scale = kMappingScaleLinear;
+        mapping->parameterNumber = 0;
+        mapping->highResolution = false;
         
         bgLayer = [[CALayer alloc] init];
         [bgLayer setBorderColor:[NSColor darkGrayColor].CGColor];
@@ -49,6 +51,8 @@
     [dataByteField setStringValue:[NSString stringWithFormat:@"%d", mapping->byte2]];
     [minField setStringValue:[NSString stringWithFormat:@"%1.1f", mapping->min]];
     [maxField setStringValue:[NSString stringWithFormat:@"%1.1f", mapping->max]];
+    [parameterNumberField setStringValue:[NSString stringWithFormat:@"%d", mapping->parameterNumber]];
+    [highResolutionSwitch setState:mapping->highResolution ? NSOnState : NSOffState];
     
     /* Populate the parameter selector menu with the voice's parameters */
     std::vector<std::string> params = _synth->masterVoice()->getParameterNames();
@@ -165,6 +169,22 @@
     [self apply];
 }
 
+/* NRPN or RPN number for mappings on controller 99 or 101 (0-16383) */
+- (IBAction)parameterNumberSet:(id)sender {
+    
+    [self cancel];
+    mapping->parameterNumber = std::min(std::max((int)[[parameterNumberField stringValue] integerValue], 0), kMidiControl_MaxValue);
+    [self apply];
+}
+
+/* Pair a controller 0-31 with its LSB (controller + 32) for 14-bit values */
+- (IBAction)highResolutionSet:(id)sender {
+    
+    [self cancel];
+    mapping->highResolution = [highResolutionSwitch state] == NSOnState;
+    [self apply];
+}
+
 - (void)fillMIDIParams:(std::vector<unsigned char> *)message {
     
     int statusByte = (int)message->at(0);
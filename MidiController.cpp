@@ -8,7 +8,7 @@
 
 #include "MidiController.h"
 
-MidiController::MidiController(PolySynth* synth) : _synth(synth), _midiIn(NULL), _midiOut(NULL) {
+MidiController::MidiController(PolySynth* synth) : _synth(synth), _midiIn(NULL), _midiOut(NULL), _outputQueue(NULL) {
 
     try {
         _midiIn = new RtMidiIn();
@@ -28,6 +28,8 @@ MidiController::MidiController(PolySynth* synth) : _synth(synth), _midiIn(NULL),
         return;
     }
     
+    _outputQueue = new MidiOutputQueue();
+    
     if (!rescanInputDevices())
         printf("%s: No MIDI input devices\n", __PRETTY_FUNCTION__);
     if (!rescanOutputDevices())
@@ -38,6 +40,9 @@ MidiController::MidiController(PolySynth* synth) : _synth(synth), _midiIn(NULL),
 
 MidiController::~MidiController() {
     
+    /* Stops the flush thread before the output it sends to is deleted */
+    if (_outputQueue)
+        delete _outputQueue;
     if (_midiIn)
         delete _midiIn;
     if (_midiOut)
@@ -73,20 +78,20 @@ void MidiController::midiInputCallback(double deltaTime, std::vector<unsigned ch
             byte2 = (int)message->at(1);
             byte3 = (int)message->at(2);
             
-            printf("Note ON: %2x %2x %2x\n", statusByte, byte2, byte3);
+            RealtimeLog::log(kLogLevel_Debug, "Note ON: %2x %2x %2x\n", statusByte, byte2, byte3);
             if (message->at(2) == 0)
-                _synth->noteOff(byte2);
+                _synth->queueNoteOff(byte2);
             
             else {
-                _synth->noteOn(byte2, byte3);
+                _synth->queueNoteOn(byte2, byte3);
             }
             
             break;
             
         case MESSAGE_CONTROL_CHANGE:
             
-            printf("Control: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
-            _synth->handleMidiControl(message);
+            RealtimeLog::log(kLogLevel_Debug, "Control: %2x %2x %2x\n", statusByte, message->at(1), message->at(2));
+            _synth->queueMidiControl(message);
             
             break;
             
@@ -132,6 +137,9 @@ bool MidiController::setOutputDevice(int devIdx) {
         return false;
     }
     
+    /* Detach the output from the flush thread while the port changes */
+    _outputQueue->setOutput(NULL);
+    
     /* Open the device */
     try {
         _midiOut->openPort(devIdx);
@@ -142,6 +150,8 @@ bool MidiController::setOutputDevice(int devIdx) {
         return false;
     }
     
+    _outputQueue->setOutput(_midiOut);
+    
     printf("%s: Using MIDI output device %s\n", __PRETTY_FUNCTION__, _outputDeviceNames[devIdx].c_str());
     
     return true;
@@ -192,21 +202,16 @@ bool MidiController::sendMRPRoutingMessage(int channel, int string) {
     }
     
     /* Construct MRP routing message */
-    vector<unsigned char> message;
-    message.push_back(MESSAGE_CONTROL_CHANGE | (unsigned char)kMRPMIDIOutputChannel);
-    message.push_back(CONTROL_MRP_BASE + (unsigned char)channel);
-    message.push_back((unsigned char)(string & 0xFF));
+    unsigned char message[3];
+    message[0] = MESSAGE_CONTROL_CHANGE | (unsigned char)kMRPMIDIOutputChannel;
+    message[1] = CONTROL_MRP_BASE + (unsigned char)channel;
+    message[2] = (unsigned char)(string & 0xFF);
     
 //    printf("%s: Sending MRP routing message %u %u %u\n", __PRETTY_FUNCTION__, message[0], message[1], message[2]);
     
-    /* Send the message */
-    try {
-        _midiOut->sendMessage(&message);
-    }
-    catch(RtMidiError& err) {
-        printf("%s: Error sending MRP routing message. RtMidiError: ", __PRETTY_FUNCTION__);
-        err.printMessage();
-        printf("\n");
+    /* Queue the message. Repeated routing of the same channel within one flush interval is coalesced */
+    if (!_outputQueue->queueMessage(message, 3)) {
+        printf("%s: Error sending MRP routing message. MIDI output queue is full.\n", __PRETTY_FUNCTION__);
         return false;
     }
     
@@ -12,6 +12,7 @@
 #include <iostream>
 #include "RtMidi.h"
 #include "PolySynth.h"
+#include "MidiOutputQueue.h"
 
 #define kMRPMIDIOutputChannel 0
 
@@ -64,6 +65,7 @@ class MidiController {
     
     RtMidiIn *_midiIn;
     RtMidiOut *_midiOut;
+    MidiOutputQueue *_outputQueue;          // Coalesces and sends output messages from its own thread
     
     std::vector<std::string> _inputDeviceNames;
     std::vector<std::string> _outputDeviceNames;
@@ -93,6 +95,7 @@ public:
     bool rescanOutputDevices();
     
 #pragma mark - RtMidi Output
+    /* Queue an MRP routing message for the output queue's next flush, without waiting on the MIDI driver */
     bool sendMRPRoutingMessage(int channel, int string);
 };
 
@@ -8,39 +8,352 @@
 
 #include "ParameterList.h"
 
+#pragma mark - MidiControlParser
+void MidiControlParser::reset() {
+    
+    for (int ch = 0; ch < kMidiControl_NumChannels; ch++) {
+        
+        ChannelState& state = _channels[ch];
+        memset(state.msb, 0xFF, sizeof(state.msb));
+        state.pairedControllers = 0;
+        state.numberMSB = state.numberLSB = 127;
+        state.rpn = false;
+        state.selected = false;
+        state.dataEntry = 0;
+    }
+}
+
+MidiControlType MidiControlParser::parse(const unsigned char *bytes, int size, const MidiDispatchTable& table, int mappingChannel, MidiControlEvent *event) {
+    
+    if (size < 2 || size > 3 || bytes[0] < 0x80 || bytes[0] >= 0xF0)
+        return kMidiControlType_Message;
+    
+    int messageType = bytes[0] & 0xF0;
+    int channel = bytes[0] & 0x0F;
+    
+    /* Pitch bend carries its own LSB */
+    if (messageType == 0xE0 && size == 3) {
+        event->type = kMidiControlType_PitchBend;
+        event->channel = channel;
+        event->number = 0;
+        event->value = ((bytes[2] & 0x7F) << 7) | (bytes[1] & 0x7F);
+        return event->type;
+    }
+    
+    if (messageType != 0xB0 || size != 3)
+        return kMidiControlType_Message;
+    
+    ChannelState& state = _channels[channel];
+    int controller = bytes[1] & 0x7F;
+    int value = bytes[2] & 0x7F;
+    
+    /* Parameter number selection. The selection controllers are still passed on to any 7-bit mappings */
+    if (controller == kMidiControl_NRPNMSB || controller == kMidiControl_RPNMSB)
+        state.numberMSB = value;
+    if (controller == kMidiControl_NRPNLSB || controller == kMidiControl_RPNLSB)
+        state.numberLSB = value;
+    
+    if (controller >= kMidiControl_NRPNLSB && controller <= kMidiControl_RPNMSB) {
+        state.rpn = controller >= kMidiControl_RPNLSB;
+        state.selected = !(state.numberMSB == 127 && state.numberLSB == 127);
+        return kMidiControlType_Message;
+    }
+    
+    /* Data entry for the selected parameter number. Unless a mapping responds to that number (e.g. the pitch bend range RPN a keyboard sends on startup), the data entry controllers are ordinary controllers */
+    bool dataEntry = controller == kMidiControl_DataEntryMSB || controller == kMidiControl_DataEntryLSB || controller == kMidiControl_DataIncrement || controller == kMidiControl_DataDecrement;
+        
+    if (state.selected && dataEntry) {
+        
+        if (controller == kMidiControl_DataEntryMSB)
+            state.dataEntry = value << 7;
+        else if (controller == kMidiControl_DataEntryLSB)
+            state.dataEntry = (state.dataEntry & ~0x7F) | value;
+        else {
+            state.dataEntry += controller == kMidiControl_DataIncrement ? 128 : -128;
+            state.dataEntry = std::min(std::max(state.dataEntry, 0), kMidiControl_MaxValue);
+        }
+        
+        if (table.hasParameterNumber(mappingChannel, state.rpn, (state.numberMSB << 7) | state.numberLSB))
+            return parameterNumberEvent(state, channel, event);
+    }
+    
+    event->type = kMidiControlType_Controller;
+    event->channel = channel;
+    
+    /* MSB of a controller with a 14-bit mapping that's known to send LSBs */
+    if (controller < kMidiControl_NumPairedControllers) {
+        
+        state.msb[controller] = value;
+        if (!table.isPairedController(mappingChannel, controller) || !(state.pairedControllers & (1u << controller)))
+            return kMidiControlType_Message;
+        
+        event->number = controller;
+        event->value = value << 7;
+        return event->type;
+    }
+    
+    /* LSB completing a 14-bit value. LSBs of controllers without 14-bit mappings are left to any 7-bit mappings on the LSB controller */
+    int msbController = controller - kMidiControl_NumPairedControllers;
+    if (msbController < kMidiControl_NumPairedControllers && table.isPairedController(mappingChannel, msbController) && state.msb[msbController] <= 127) {
+        
+        state.pairedControllers |= 1u << msbController;
+        event->number = msbController;
+        event->value = (state.msb[msbController] << 7) | value;
+        return event->type;
+    }
+    
+    return kMidiControlType_Message;
+}
+
+MidiControlType MidiControlParser::parameterNumberEvent(ChannelState& state, int channel, MidiControlEvent *event) {
+    
+    event->type = state.rpn ? kMidiControlType_RPN : kMidiControlType_NRPN;
+    event->channel = channel;
+    event->number = (state.numberMSB << 7) | state.numberLSB;
+    event->value = state.dataEntry;
+    return event->type;
+}
+
+#pragma mark - MidiDispatchTable
+MidiDispatchTable::MidiDispatchTable() {
+    
+    for (int i = 0; i < 128; i++)
+        _rowIndex[i] = -1;
+    memset(_pairedControllers, 0, sizeof(_pairedControllers));
+}
+
+void MidiDispatchTable::compile(const map<int, vector<MidiMapping*> >& listeners, ParameterList *list) {
+    
+    _entries.clear();
+    _rows.clear();
+    _parameterNumbers.clear();
+    for (int i = 0; i < 128; i++)
+        _rowIndex[i] = -1;
+    memset(_pairedControllers, 0, sizeof(_pairedControllers));
+    
+    vector<pair<int, MidiDispatchEntry> > numberEntries;
+    
+    for (map<int, vector<MidiMapping*> >::const_iterator it = listeners.begin(); it != listeners.end(); ++it) {
+        
+        int status = it->first >> 8;
+        int data1 = it->first & 0xFF;
+        if (status < 0x80 || status > 0xFF || data1 > 127)
+            continue;
+        
+        /* NRPN and RPN mappings are keyed by their parameter numbers and added after the rows */
+        if ((status & 0xF0) == 0xB0 && (data1 == kMidiControl_NRPNMSB || data1 == kMidiControl_RPNMSB)) {
+            
+            for (int i = 0; i < it->second.size(); i++) {
+                
+                MidiMapping *mapping = it->second[i];
+                int id = list->getParameterID(mapping->parameterName);
+                if (id < 0)
+                    continue;
+                
+                MidiDispatchEntry entry = { id, mapping->parameterName, mapping->type, mapping->ramp, mapping->min, mapping->max, mapping->scale };
+                numberEntries.push_back(pair<int, MidiDispatchEntry>(parameterNumberKey(status & 0x0F, data1 == kMidiControl_RPNMSB, mapping->parameterNumber), entry));
+            }
+            continue;
+        }
+        
+        /* Resolve each mapping's parameter once, here, rather than for every message */
+        int first = (int)_entries.size();
+        for (int i = 0; i < it->second.size(); i++) {
+            
+            MidiMapping *mapping = it->second[i];
+            int id = list->getParameterID(mapping->parameterName);
+            if (id < 0)
+                continue;
+            
+            MidiDispatchEntry entry = { id, mapping->parameterName, mapping->type, mapping->ramp, mapping->min, mapping->max, mapping->scale };
+            _entries.push_back(entry);
+            
+            if (mapping->highResolution && (status & 0xF0) == 0xB0 && data1 < kMidiControl_NumPairedControllers)
+                _pairedControllers[status & 0x0F] |= 1u << data1;
+        }
+        
+        if ((int)_entries.size() == first)
+            continue;
+        
+        if (_rowIndex[status - 0x80] < 0) {
+            Row row;
+            memset(&row, 0, sizeof(Row));
+            _rowIndex[status - 0x80] = (short)_rows.size();
+            _rows.push_back(row);
+        }
+        
+        Row& row = _rows[_rowIndex[status - 0x80]];
+        row.first[data1] = (unsigned short)first;
+        row.count[data1] = (unsigned short)(_entries.size() - first);
+    }
+    
+    /* Group the parameter number entries by key so lookupControl() can binary search them */
+    std::stable_sort(numberEntries.begin(), numberEntries.end(), [](const pair<int, MidiDispatchEntry>& a, const pair<int, MidiDispatchEntry>& b) { return a.first < b.first; });
+    
+    for (int i = 0; i < numberEntries.size(); i++) {
+        
+        if (_parameterNumbers.empty() || _parameterNumbers.back().key != numberEntries[i].first) {
+            ParameterNumberGroup group = { numberEntries[i].first, (unsigned short)_entries.size(), 0 };
+            _parameterNumbers.push_back(group);
+        }
+        
+        _entries.push_back(numberEntries[i].second);
+        _parameterNumbers.back().count++;
+    }
+}
+
+bool MidiDispatchTable::hasParameterNumber(int channel, bool rpn, int number) const {
+    
+    if (_parameterNumbers.empty())
+        return false;
+    
+    int key = parameterNumberKey(channel, rpn, number);
+    vector<ParameterNumberGroup>::const_iterator it = std::lower_bound(_parameterNumbers.begin(), _parameterNumbers.end(), key, [](const ParameterNumberGroup& group, int k) { return group.key < k; });
+    return it != _parameterNumbers.end() && it->key == key;
+}
+
+int MidiDispatchTable::lookupControl(const MidiControlEvent& event, const MidiDispatchEntry **entries) const {
+    
+    switch (event.type) {
+            
+        case kMidiControlType_Controller:
+            return lookupRow(0xB0 | event.channel, event.number, entries);
+            
+        case kMidiControlType_PitchBend:
+            return lookupRow(0xE0 | event.channel, 0, entries);
+            
+        case kMidiControlType_NRPN:
+        case kMidiControlType_RPN: {
+            
+            int key = parameterNumberKey(event.channel, event.type == kMidiControlType_RPN, event.number);
+            vector<ParameterNumberGroup>::const_iterator it = std::lower_bound(_parameterNumbers.begin(), _parameterNumbers.end(), key, [](const ParameterNumberGroup& group, int k) { return group.key < k; });
+            if (it == _parameterNumbers.end() || it->key != key)
+                return 0;
+            
+            *entries = _entries.data() + it->first;
+            return it->count;
+        }
+            
+        default:
+            return 0;
+    }
+}
+
+int MidiDispatchTable::resolve(const unsigned char *bytes, int size, MidiControlParser *parser, int lookupChannel, const MidiDispatchEntry **entries, float *position) const {
+    
+    if (size < 2 || size > 3)
+        return 0;
+    
+    MidiControlEvent event;
+    int mappingChannel = lookupChannel >= 0 ? lookupChannel : bytes[0] & 0x0F;
+    MidiControlType type = parser ? parser->parse(bytes, size, *this, mappingChannel, &event) : kMidiControlType_Message;
+    
+    /* Ordinary 7-bit messages */
+    if (type == kMidiControlType_Message) {
+        
+        unsigned char message[3];
+        memcpy(message, bytes, size);
+        if (lookupChannel >= 0)
+            message[0] = (message[0] & 0xF0) | lookupChannel;
+        
+        int value;
+        int n = lookup(message, size, entries, &value);
+        *position = (float)value / 127.0f;
+        return n;
+    }
+    
+    if (lookupChannel >= 0)
+        event.channel = lookupChannel;
+    
+    *position = (float)event.value / kMidiControl_MaxValue;
+    return lookupControl(event, entries);
+}
+
+float MidiDispatchTable::mappedValue(const MidiDispatchEntry& entry, float position) {
+    
+    /* Scale the control position to the range specified by the mapping */
+    float fval = position;
+    fval *= (entry.max - entry.min);
+    fval += entry.min;
+    
+    /* If the mapping is logarithmic, scale it again */
+    if (entry.scale == kMappingScaleLogarithmic)
+        fval = entry.min * expf(fval * logf(entry.max / entry.min) / (entry.max - entry.min));
+    
+    return fval;
+}
+
+void MidiDispatchTable::apply(const MidiDispatchEntry& entry, SynthParameter *param, float value) {
+    
+    switch (entry.type) {
+            
+        case kMappingTypeAssign:
+            if (entry.ramp) param->setValue(value);
+            else *param = value;
+            break;
+            
+        case kMappingTypeAdd:
+            if (entry.ramp) param->setValue(*param + value);
+            else *param += value;
+            break;
+            
+        case kMappingTypeMultiply:
+            if (entry.ramp) param->setValue(*param * value);
+            else *param *= value;
+            break;
+            
+        default:
+            break;
+    }
+}
+
+#pragma mark - ParameterList
+
 bool ParameterList::hasParameter(string name) {
-    return _parameters.find(name) != _parameters.end();
+    return _parameterIDs.find(name) != _parameterIDs.end();
 }
 
+/* Names in alphabetical order */
 vector<string> ParameterList::getParameterNames() {
     vector<string> names;
-    for (map<string, SynthParameter*>::iterator it = _parameters.begin(); it != _parameters.end(); it++) {
-        names.push_back((*it).second->name());
+    for (map<string, int>::iterator it = _parameterIDs.begin(); it != _parameterIDs.end(); it++) {
+        names.push_back(_parameters[(*it).second]->name());
     }
     return names;
 }
 
 SynthParameter* ParameterList::getParameterWithName(string name) {
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    map<string, int>::iterator it = _parameterIDs.find(name);
+    if (it == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return nullptr;
     }
     
-    return _parameters[name];
+    return _parameters[(*it).second];
+}
+
+int ParameterList::getParameterID(string name) {
+    map<string, int>::iterator it = _parameterIDs.find(name);
+    return it == _parameterIDs.end() ? -1 : (*it).second;
 }
 
 bool ParameterList::addParameter(SynthParameter* param) {
     
     /* Make sure we don't already have a parameter with this name */
-    if (_parameters.find(param->name()) != _parameters.end()) {
-        printf("%s: Duplicate parameter %s\n", __PRETTY_FUNCTION__, param->name().c_str());
+    if (_parameterIDs.find(param->name()) != _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Duplicate parameter %s\n", __PRETTY_FUNCTION__, param->name().c_str());
         return false;
     }
     
-    printf("%s: Adding parameter \"%s\"\n", __PRETTY_FUNCTION__, param->name().c_str());
+    RealtimeLog::log(kLogLevel_Debug, "%s: Adding parameter \"%s\"\n", __PRETTY_FUNCTION__, param->name().c_str());
+    
+    _parameterIDs[param->name()] = (int)_parameters.size();
+    _parameters.push_back(param);
     
-    _parameters[param->name()] = param;
+    /* Mappings to this parameter may have been added before it was. Recompiled once by commitParameters() */
+    if (!_midiListeners.empty())
+        _midiDispatchStale = true;
     
 //    printf("%s: ""%s"" ", __PRETTY_FUNCTION__, param->name().c_str());
 //    for (int i = 0; i < 30 - param->name().size(); i++)
@@ -52,10 +365,10 @@ bool ParameterList::addParameter(SynthParameter* param) {
 
 bool ParameterList::removeParameter(string name) {
     
-    map<string, SynthParameter*>::iterator it = _parameters.find(name);
+    map<string, int>::iterator it = _parameterIDs.find(name);
     
-    if (it == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (it == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
@@ -64,39 +377,76 @@ bool ParameterList::removeParameter(string name) {
 //        printf(" ");
 //    printf("[size = %lu]\n", _parameters.size());
     
-    _parameters.erase(it);
+    /* Keep the IDs dense by moving the last parameter into the removed one's slot */
+    int id = (*it).second;
+    int last = (int)_parameters.size() - 1;
+    
+    if (id != last) {
+        _parameters[id] = _parameters[last];
+        _parameterIDs[_parameters[id]->name()] = id;
+    }
+    
+    _parameters.pop_back();
+    _parameterIDs.erase(it);
+    if (!_midiListeners.empty())
+        _midiDispatchStale = true;
     return true;
 }
 
 void ParameterList::clearParameterList() {
     _parameters.clear();
+    _parameterIDs.clear();
+    if (!_midiListeners.empty())
+        _midiDispatchStale = true;
 }
 
 /* Ramp all parameters in the list for a single sample */
 void ParameterList::parameterListRamp() {
-    for (map<string, SynthParameter*>::iterator it = _parameters.begin(); it != _parameters.end(); ++it)
-        (*it).second->ramp();
+    
+    SynthParameter **params = _parameters.data();
+    int n = (int)_parameters.size();
+    
+    for (int i = 0; i < n; i++)
+        params[i]->ramp();
+}
+
+/* Ramp all parameters in the list for a control block of nSamples. Parameters that have reached their target are skipped */
+void ParameterList::parameterListRamp(int nSamples) {
+    
+    SynthParameter **params = _parameters.data();
+    int n = (int)_parameters.size();
+    
+    for (int i = 0; i < n; i++) {
+        if (params[i]->isRamping())
+            params[i]->ramp(nSamples);
+    }
 }
 
 bool ParameterList::addMidiMapping(MidiMapping *mapping) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(mapping->parameterName) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
+    if (_parameterIDs.find(mapping->parameterName) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
         return false;
     }
     
     /* Make sure the bytes are valid MIDI bytes */
     if (mapping->byte1 < 0 || mapping->byte1 >= 255) {
-        printf("%s: Invalid MIDI byte %x. Specify a number 0x00-0x7f\n", __PRETTY_FUNCTION__, mapping->byte1);
+        RealtimeLog::log(kLogLevel_Warning, "%s: Invalid MIDI byte %x. Specify a number 0x00-0x7f\n", __PRETTY_FUNCTION__, mapping->byte1);
         return false;
     }
     if (mapping->byte2 < 0 || mapping->byte2 >= 127) {
-        printf("%s: Invalid MIDI byte %x. Specify a number 0x00-0x7f\n", __PRETTY_FUNCTION__, mapping->byte2);
+        RealtimeLog::log(kLogLevel_Warning, "%s: Invalid MIDI byte %x. Specify a number 0x00-0x7f\n", __PRETTY_FUNCTION__, mapping->byte2);
+        return false;
+    }
+    
+    if ((mapping->byte1 & 0xF0) == 0xB0 && (mapping->byte2 == kMidiControl_NRPNMSB || mapping->byte2 == kMidiControl_RPNMSB) && (mapping->parameterNumber < 0 || mapping->parameterNumber > kMidiControl_MaxValue)) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Invalid parameter number %d. Specify a number 0-%d\n", __PRETTY_FUNCTION__, mapping->parameterNumber, kMidiControl_MaxValue);
         return false;
     }
     
     _midiListeners[(mapping->byte1 << 8) | mapping->byte2].push_back(mapping);
+    rebuildMidiDispatch();
     
     return true;
 }
@@ -104,8 +454,8 @@ bool ParameterList::addMidiMapping(MidiMapping *mapping) {
 bool ParameterList::addOscMapping(OscMapping mapping) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(mapping.parameterName) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping.parameterName.c_str());
+    if (_parameterIDs.find(mapping.parameterName) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping.parameterName.c_str());
         return false;
     }
     
@@ -129,8 +479,8 @@ bool ParameterList::respondsToOscEvent(string path) {
 bool ParameterList::removeMidiMapping(string name) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (_parameterIDs.find(name) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
@@ -172,8 +522,9 @@ bool ParameterList::removeMidiMapping(string name) {
     }
     
     if (!found)
-        printf("%s: Parameter %s does not respond to MIDI events\n", __PRETTY_FUNCTION__, name.c_str());
+        RealtimeLog::log(kLogLevel_Warning, "%s: Parameter %s does not respond to MIDI events\n", __PRETTY_FUNCTION__, name.c_str());
     
+    rebuildMidiDispatch();
     return found;
 }
 
@@ -184,14 +535,14 @@ bool ParameterList::removeMidiMapping(string name, int byte1) {
 bool ParameterList::removeMidiMapping(string name, int byte1, int byte2) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (_parameterIDs.find(name) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
     /* Make sure at least one parameter responds to the specified event */
     if (!respondsToMidiEvent(byte1, byte2)) {
-        printf("%s: No parameters respond to MIDI event with bytes (%x, %x)\n", __PRETTY_FUNCTION__, byte1, byte2);
+        RealtimeLog::log(kLogLevel_Warning, "%s: No parameters respond to MIDI event with bytes (%x, %x)\n", __PRETTY_FUNCTION__, byte1, byte2);
         return false;
     }
     
@@ -214,14 +565,15 @@ bool ParameterList::removeMidiMapping(string name, int byte1, int byte2) {
     if (mappings.size() == 0)
         _midiListeners.erase(_midiListeners.find((byte1 << 8) | byte2));
     
+    rebuildMidiDispatch();
     return true;
 }
 
 bool ParameterList::removeMidiMapping(MidiMapping *mapping) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(mapping->parameterName) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
+    if (_parameterIDs.find(mapping->parameterName) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
         return false;
     }
     
@@ -263,16 +615,17 @@ bool ParameterList::removeMidiMapping(MidiMapping *mapping) {
     }
     
     if (!found)
-        printf("%s: Parameter %s does not respond to MIDI events\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
+        RealtimeLog::log(kLogLevel_Warning, "%s: Parameter %s does not respond to MIDI events\n", __PRETTY_FUNCTION__, mapping->parameterName.c_str());
     
+    rebuildMidiDispatch();
     return found;
 }
 
 bool ParameterList::removeOscMapping(string name) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (_parameterIDs.find(name) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
@@ -313,7 +666,7 @@ bool ParameterList::removeOscMapping(string name) {
     }
     
     if (!found)
-        printf("%s: Parameter %s does not respond to OSC events\n", __PRETTY_FUNCTION__, name.c_str());
+        RealtimeLog::log(kLogLevel_Warning, "%s: Parameter %s does not respond to OSC events\n", __PRETTY_FUNCTION__, name.c_str());
     
     return found;
 }
@@ -321,14 +674,14 @@ bool ParameterList::removeOscMapping(string name) {
 bool ParameterList::removeOscMapping(string name, string path) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (_parameterIDs.find(name) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
     /* Make sure at least one parameter responds to the specified event */
     if (!respondsToOscEvent(path)) {
-        printf("%s: No parameters respond to OSC event with path %s\n", __PRETTY_FUNCTION__, path.c_str());
+        RealtimeLog::log(kLogLevel_Warning, "%s: No parameters respond to OSC event with path %s\n", __PRETTY_FUNCTION__, path.c_str());
         return false;
     }
     
@@ -362,15 +715,17 @@ bool ParameterList::removeOscMapping(OscMapping *mapping) {
 bool ParameterList::setParameterValue(string name, float value, bool doRamp) {
     
     /* Make sure we have a parameter with this name */
-    if (_parameters.find(name) == _parameters.end()) {
-        printf("%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
+    if (_parameterIDs.find(name) == _parameterIDs.end()) {
+        RealtimeLog::log(kLogLevel_Warning, "%s: Unknown parameter %s\n", __PRETTY_FUNCTION__, name.c_str());
         return false;
     }
     
+    SynthParameter *param = _parameters[_parameterIDs[name]];
+    
     if (doRamp)
-        (*_parameters.find(name)).second->setValue(value);
+        param->setValue(value);
     else
-        *(*_parameters.find(name)).second = value;
+        *param = value;
     
     return true;
 }
@@ -378,71 +733,28 @@ bool ParameterList::setParameterValue(string name, float value, bool doRamp) {
 vector<pair<string, float> > ParameterList::handleMidi(vector<unsigned char>* message) {
     
     vector<pair<string, float> > updatedParams;
+    handleMidi(message, &updatedParams);
     
-    int statusByte = (int)message->at(0);
+    return updatedParams;
+}
+
+void ParameterList::handleMidi(vector<unsigned char>* message, vector<pair<string, float> >* updatedParams) {
     
-    int key;
-    int value = 0;
+    commitParameters();
     
-    if (message->size() == 2) {
-        key = (statusByte << 8) | 0x00;
-        value = message->at(1);
-    }
-    else if (message->size() == 3) {
-        key = (statusByte << 8) | message->at(1);
-        value = message->at(2);
-    }
-    else
-        return updatedParams;
+    const MidiDispatchEntry *entries;
+    float position;
+    int n = _midiDispatch.resolve(message->data(), (int)message->size(), &_midiParser, -1, &entries, &position);
     
-    /* If we have mappings for this message */
-    if (_midiListeners.find(key) != _midiListeners.end()) {
+    for (int i = 0; i < n; i++) {
         
-        /* Return the vector of mappings and iterate over each one */
-        vector<MidiMapping*>& mappings = _midiListeners[key];
-        for (int i = 0; i < mappings.size(); i++) {
-            
-            /* Get the parameter for this mapping */
-            SynthParameter* param = _parameters[mappings[i]->parameterName];
-            
-            /* Scale the 0-127 MIDI value to the range specified by the mapping */
-            float fval = (float)value / 127.0f;
-            fval *= (mappings[i]->max - mappings[i]->min);
-            fval += mappings[i]->min;
-            
-            /* If the mapping is logarithmic, scale it again */
-            if (mappings[i]->scale == kMappingScaleLogarithmic) {
-                fval = mappings[i]->min * expf(fval * logf(mappings[i]->max / mappings[i]->min) /
-                                               (mappings[i]->max - mappings[i]->min));
-            }
-            
-            switch (mappings[i]->type) {
-                    
-                case kMappingTypeAssign:
-                    if (mappings[i]->ramp) param->setValue(fval);
-                    else *param = fval;
-                    break;
-                    
-                case kMappingTypeAdd:
-                    if (mappings[i]->ramp) param->setValue(*param + fval);
-                    else *param += fval;
-                    break;
-                    
-                case kMappingTypeMultiply:
-                    if (mappings[i]->ramp) param->setValue(*param * fval);
-                    else *param *= fval;
-                    break;
-                    
-                default:
-                    break;
-            }
-            
-            /* Store the updated parameter's name and value for the return value */
-            updatedParams.push_back(pair<string, float>(mappings[i]->parameterName, param->value()));
-        }
+        SynthParameter *param = _parameters[entries[i].parameterID];
+        MidiDispatchTable::apply(entries[i], param, MidiDispatchTable::mappedValue(entries[i], position));
+        
+        /* Store the updated parameter's name and value if the caller wants them */
+        if (updatedParams)
+            updatedParams->push_back(pair<string, float>(entries[i].parameterName, param->value()));
     }
-    
-    return updatedParams;
 }
 
 void ParameterList::handleOsc() {
@@ -454,9 +766,9 @@ void ParameterList::parameterListPrint() {
     
     int cnt = 0;
     printf("\nParameter List:\n---------------\n");
-    for (map<string, SynthParameter*>::iterator it = _parameters.begin(); it != _parameters.end(); ++it) {
-        printf("#%d: it = %d; ", cnt, (int&)*it);
-        printf("  %24s = %f\n", (*it).second->name().c_str(), (*it).second->value());
+    for (map<string, int>::iterator it = _parameterIDs.begin(); it != _parameterIDs.end(); ++it) {
+        printf("#%d: id = %d; ", cnt, (*it).second);
+        printf("  %24s = %f\n", _parameters[(*it).second]->name().c_str(), _parameters[(*it).second]->value());
         cnt++;
     }
     
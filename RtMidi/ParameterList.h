@@ -13,8 +13,11 @@
 #include <vector>
 #include <map>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 
 #include "SynthParameter.h"
+#include "RealtimeLog.h"
 
 //! List of SynthParameter types indexable by the parameter name, or any MIDI messages or OSC paths the parameter responds to. This class should not be instantiated on its own, as the addParameter() method is protected. Classes that contain a list of SynthParameter types should inherit from ParameterList.
 /*! Classes that inherit from ParameterList can use the protected member addParameter() to add their SynthParameter types to the parameter list, which makes the parameters accessible by name.
@@ -28,6 +31,18 @@
 
 using namespace std;
 
+#define kMidiControl_NumChannels 16
+#define kMidiControl_NumPairedControllers 32    // Controllers 0-31 take an optional LSB on controllers 32-63
+#define kMidiControl_MaxValue 16383             // Largest 14-bit control value
+#define kMidiControl_DataEntryMSB 6
+#define kMidiControl_DataEntryLSB 38
+#define kMidiControl_DataIncrement 96
+#define kMidiControl_DataDecrement 97
+#define kMidiControl_NRPNLSB 98
+#define kMidiControl_NRPNMSB 99
+#define kMidiControl_RPNLSB 100
+#define kMidiControl_RPNMSB 101
+
 typedef enum MappingType {
     kMappingTypeAssign = 0,
     kMappingTypeAdd,
@@ -39,6 +54,7 @@ typedef enum MappingScale {
     kMappingScaleLogarithmic
 } MappingScale;
 
+/* Control change mappings on controller 99 (kMidiControl_NRPNMSB) or 101 (kMidiControl_RPNMSB) respond to data entry for the NRPN or RPN parameterNumber. Control change mappings on controllers 0-31 with highResolution set respond to 14-bit values from the controller and its LSB (controller + 32). All other mappings respond to the message itself with its 7-bit value */
 typedef struct MidiMapping {
     int byte1, byte2;
     string parameterName;
@@ -46,8 +62,144 @@ typedef struct MidiMapping {
     bool ramp;
     float min, max;
     MappingScale scale;
+    int parameterNumber;
+    bool highResolution;
 } MidiMapping;
 
+/* Kind of value a MidiControlParser assembled from a message */
+typedef enum MidiControlType {
+    kMidiControlType_Message = 0,   // An ordinary message with a 7-bit value, to be dispatched as it is
+    kMidiControlType_Controller,    // 14-bit control change (controller 0-31 paired with its LSB)
+    kMidiControlType_PitchBend,     // 14-bit pitch bend
+    kMidiControlType_NRPN,          // 14-bit data entry for a non-registered parameter number
+    kMidiControlType_RPN            // 14-bit data entry for a registered parameter number
+} MidiControlType;
+
+typedef struct MidiControlEvent {
+    MidiControlType type;
+    int channel;
+    int number;         // Controller or parameter number
+    int value;          // 0 to kMidiControl_MaxValue
+} MidiControlEvent;
+
+class MidiDispatchTable;
+
+//! Assembles high-resolution control values from a stream of MIDI messages
+/*!
+    Keeps the state of each MIDI channel in fixed arrays, so parsing never allocates and can run on the audio thread. High-resolution values are only assembled where a MidiDispatchTable has mappings that ask for them. Every other message, including the LSBs and data entry controllers nothing has opted in to, is reported as the ordinary 7-bit message it is.
+ 
+    Controllers 0-31 with a highResolution mapping become 14-bit once an LSB (controllers 32-63) has been received for them. Each LSB completes a 14-bit value with the controller's last MSB, and later MSBs are reported as 14-bit values with the LSB reset to zero, so a paired controller's values are all on the same scale. Until then, MSBs and LSBs are ordinary 7-bit messages.
+ 
+    Controllers 99/98 (NRPN) and 101/100 (RPN) select a parameter number. While a parameter number with a mapping is selected, data entry (controllers 6 and 38) and data increment/decrement (96 and 97, one MSB step) report 14-bit values for it. Selecting parameter 127/127 deselects it. Pitch bend is always reported as a 14-bit value.
+*/
+class MidiControlParser {
+    
+    struct ChannelState {
+        unsigned char msb[kMidiControl_NumPairedControllers];  // Last MSB of each controller (0xFF if none received)
+        unsigned int pairedControllers;     // Bit n set once controller n has received an LSB
+        int numberMSB, numberLSB;           // Selected (N)RPN parameter number
+        bool rpn;
+        bool selected;
+        int dataEntry;                      // Current 14-bit data entry value
+    };
+    
+    ChannelState _channels[kMidiControl_NumChannels];
+    
+    MidiControlType parameterNumberEvent(ChannelState& state, int channel, MidiControlEvent *event);
+    
+public:
+    
+    MidiControlParser() { reset(); }
+    
+    void reset();
+    
+    /* Update the channel state with a message and report any value it completes in *event, for the mappings table has on MIDI channel mappingChannel (normally the message's own) */
+    MidiControlType parse(const unsigned char *bytes, int size, const MidiDispatchTable& table, int mappingChannel, MidiControlEvent *event);
+};
+
+/* A MidiMapping compiled for dispatch, with its parameter resolved to a parameter ID */
+typedef struct MidiDispatchEntry {
+    int parameterID;
+    string parameterName;
+    MappingType type;
+    bool ramp;
+    float min, max;
+    MappingScale scale;
+} MidiDispatchEntry;
+
+class ParameterList;
+
+//! MIDI mappings compiled into a table indexed directly by the message bytes
+/*!
+    Finding the mappings for a message is two array lookups (status byte, then data byte) with no map searches or parameter name comparisons, and each mapping's parameter is addressed by its ID. Rows of 128 data bytes are only allocated for status bytes that have mappings.
+ 
+    Parameter lists with the same parameters added in the same order (e.g. a master voice and its clones) have the same parameter IDs, so one table compiled from the master voice can update every voice.
+*/
+class MidiDispatchTable {
+    
+    struct Row {
+        unsigned short first[128];      // Index of the first entry for each data byte
+        unsigned short count[128];      // Number of entries for each data byte
+    };
+    
+    /* Entries for one NRPN or RPN parameter number, sorted by key */
+    struct ParameterNumberGroup {
+        int key;                        // See parameterNumberKey()
+        unsigned short first, count;
+    };
+    
+    vector<MidiDispatchEntry> _entries;     // Grouped by message
+    vector<Row> _rows;
+    short _rowIndex[128];                   // Row for each status byte 0x80-0xFF (-1 if none)
+    vector<ParameterNumberGroup> _parameterNumbers;
+    unsigned int _pairedControllers[kMidiControl_NumChannels];  // Bit n set if controller n (0-31) of a channel has a highResolution mapping
+    
+    static int parameterNumberKey(int channel, bool rpn, int number) { return (channel << 15) | (rpn << 14) | (number & kMidiControl_MaxValue); }
+    
+    int lookupRow(int status, int data1, const MidiDispatchEntry **entries) const {
+        
+        int row = _rowIndex[status - 0x80];
+        if (row < 0 || !_rows[row].count[data1])
+            return 0;
+        
+        *entries = _entries.data() + _rows[row].first[data1];
+        return _rows[row].count[data1];
+    }
+    
+public:
+    
+    MidiDispatchTable();
+    
+    /* Rebuild the table from a parameter list's mappings (keyed by (byte1 << 8) | byte2). Mappings to unknown parameters are skipped */
+    void compile(const map<int, vector<MidiMapping*> >& listeners, ParameterList *list);
+    
+    /* Get the entries for a two- or three-byte message. Returns the number of entries, and sets *value to the message's last data byte */
+    int lookup(const unsigned char *bytes, int size, const MidiDispatchEntry **entries, int *value) const {
+        
+        if (size < 2 || size > 3 || bytes[0] < 0x80)
+            return 0;
+        
+        *value = bytes[size-1];
+        return lookupRow(bytes[0], size == 3 ? bytes[1] & 0x7F : 0, entries);
+    }
+    
+    /* Whether a controller (0-31) has a highResolution mapping, or an NRPN or RPN parameter number has a mapping, on a MIDI channel */
+    bool isPairedController(int channel, int controller) const { return (_pairedControllers[channel] >> controller) & 1; }
+    bool hasParameterNumber(int channel, bool rpn, int number) const;
+    
+    /* Get the entries for a high-resolution value from a MidiControlParser. Pitch bend uses the mappings with data byte 0 */
+    int lookupControl(const MidiControlEvent& event, const MidiDispatchEntry **entries) const;
+    
+    /* Parse a message with parser (if not NULL) and get the entries it applies to, with the value to map scaled to 0-1. If lookupChannel isn't -1, the mappings for that MIDI channel are used instead of the message's */
+    int resolve(const unsigned char *bytes, int size, MidiControlParser *parser, int lookupChannel, const MidiDispatchEntry **entries, float *position) const;
+    
+    /* Scale a 0-1 control position to the range of an entry's mapping */
+    static float mappedValue(const MidiDispatchEntry& entry, float position);
+    
+    /* Update a parameter with a value from mappedValue() according to the entry's mapping type */
+    static void apply(const MidiDispatchEntry& entry, SynthParameter *param, float value);
+};
+
 typedef struct OscMapping {
     string path;
     string parameterName;
@@ -57,13 +209,22 @@ typedef struct OscMapping {
 
 class ParameterList {
     
-    /* Accessible parameters indexed by name (one-to-one) */
-    map<string, SynthParameter*> _parameters;
+    /* Accessible parameters stored contiguously and indexed by dense integer IDs, so ramping is a single linear pass. IDs stay valid until a parameter is removed */
+    vector<SynthParameter*> _parameters;
+    
+    /* Parameter IDs indexed by name (one-to-one) for UI and mapping lookups */
+    map<string, int> _parameterIDs;
     
     /* Mappings indexed by a MIDI or OSC message. Multiple mappings may respond to the same message */
     map<int, vector<MidiMapping*> > _midiListeners;
     map<string, vector<OscMapping> > _oscListeners;
     
+    /* _midiListeners compiled for handleMidi(). Rebuilt whenever the mappings change. Adding or removing parameters only marks it stale, so a voice adding many parameters compiles it once in commitParameters() */
+    MidiDispatchTable _midiDispatch;
+    MidiControlParser _midiParser;      // 14-bit and (N)RPN state of the messages passed to handleMidi()
+    bool _midiDispatchStale;
+    void rebuildMidiDispatch() { _midiDispatch.compile(_midiListeners, this); _midiDispatchStale = false; }
+    
 protected:
     
 //    public:
@@ -71,14 +232,28 @@ protected:
     bool removeParameter(string name);
     void clearParameterList();
     void parameterListRamp();
+    void parameterListRamp(int nSamples);
     
 public:
     
+    ParameterList() : _midiDispatchStale(false) {}
+    
+    /* Compile the MIDI dispatch table if parameters were added or removed since it was last built. Call once a voice (or a clone) has finished adding its parameters; handleMidi() also calls it in case nobody did */
+    void commitParameters() { if (_midiDispatchStale) rebuildMidiDispatch(); }
+    
     /* Get a list of accessible parameter names */
     bool hasParameter(string name);
     vector<string> getParameterNames();
     SynthParameter* getParameterWithName(string name);
     
+    /* Get a parameter's ID (-1 if unknown), or the parameter with an ID */
+    int getParameterID(string name);
+    SynthParameter* getParameterWithID(int id) { return id >= 0 && id < (int)_parameters.size() ? _parameters[id] : nullptr; }
+    int numParameters() { return (int)_parameters.size(); }
+    
+    /* Compile this list's MIDI mappings into a table, e.g. one shared by other lists with the same parameters */
+    void compileMidiDispatchTable(MidiDispatchTable *table) { table->compile(_midiListeners, this); }
+    
     /* Adding mappings */
     bool addMidiMapping(MidiMapping *mapping);
     bool addOscMapping(OscMapping mapping);
@@ -104,6 +279,9 @@ public:
     
     /* Related note: we can also have the objective C MIDI class forward its incoming messages to the selected mapping item view controller so it can automatically populate the MIDI message parameters with the most recent MIDI control message. */
     vector<pair<string, float> > handleMidi(vector<unsigned char>* message);
+    
+    /* Same as above, but appends the updated parameters to updatedParams instead of returning them. Pass NULL to skip collecting them, which avoids allocating on the audio thread */
+    void handleMidi(vector<unsigned char>* message, vector<pair<string, float> >* updatedParams);
     void handleOsc();
     
     /* Display mapped parameters */
@@ -9,26 +9,14 @@
 #include "SubtractiveSynthVoice.h"
 
 
-SubtractiveSynthVoice::SubtractiveSynthVoice() : _numHarmonics(1) {
+SubtractiveSynthVoice::SubtractiveSynthVoice() {
     
 }
 
-SubtractiveSynthVoice::SubtractiveSynthVoice(int numHarmonics) : _numHarmonics(numHarmonics), _filter(BiquadFilter()), _filterEnv(ADSREnvelope()), _filterEnvInvert(false) {
+SubtractiveSynthVoice::SubtractiveSynthVoice(int numHarmonics) : HarmonicSynthVoice(numHarmonics), _filter(BiquadFilter()), _filterEnv(ADSREnvelope()), _filterEnvInvert(false) {
     
     _fs = kSynthVoice_Default_fs;
     
-    SynthParameter* p;
-    for (int i = 0; i < _numHarmonics; i++) {
-        
-        char name[12];
-        sprintf(name, "Harmonic %d", i+1);
-        p = new SynthParameter(name, _fs, i == 0 ? 1.0f : 0.0f, 0.1f);
-        p->setRange(0.0f, 1.0f);
-        
-        _harmonicAmps.push_back(p);             // Store harmonic amplitudes in a vector
-        addParameter(p);                        // Add to the public parameter list
-    }
-    
     /* Get Fc and Q parameters from the filter to add to the parameter list */
     vector<SynthParameter*> params = _filter.getParameters();
     for (int i = 0; i < params.size(); i++)
@@ -43,22 +31,10 @@ SubtractiveSynthVoice::SubtractiveSynthVoice(int numHarmonics) : _numHarmonics(n
     }
 }
 
-SubtractiveSynthVoice::SubtractiveSynthVoice(std::vector<float>harmonicAmps) : _numHarmonics((int)harmonicAmps.size()), _filter(BiquadFilter()), _filterEnv(ADSREnvelope()), _filterEnvInvert(false) {
+SubtractiveSynthVoice::SubtractiveSynthVoice(std::vector<float>harmonicAmps) : HarmonicSynthVoice(harmonicAmps), _filter(BiquadFilter()), _filterEnv(ADSREnvelope()), _filterEnvInvert(false) {
     
     _fs = kSynthVoice_Default_fs;
     
-    SynthParameter* p;
-    for (int i = 0; i < _numHarmonics; i++) {
-        
-        char name[12];
-        sprintf(name, "Harmonic %d", i+1);
-        p = new SynthParameter(name, _fs, i == 0 ? 1.0f : 0.0f, 0.1f);
-        p->setRange(0.0f, 1.0f);
-        
-        _harmonicAmps.push_back(p);             // Store harmonic amplitudes in a vector
-        addParameter(p);                        // Add to the public parameter list
-    }
-    
     /* Get Fc and Q parameters from the filter to add to the parameter list */
     vector<SynthParameter*> params = _filter.getParameters();
     for (int i = 0; i < params.size(); i++)
@@ -73,21 +49,7 @@ SubtractiveSynthVoice::SubtractiveSynthVoice(std::vector<float>harmonicAmps) : _
     }
 }
 
-SubtractiveSynthVoice::SubtractiveSynthVoice(SubtractiveSynthVoice *master) : SynthVoice(master), _numHarmonics(master->_numHarmonics), _filter(BiquadFilter(&master->_filter)), _filterEnv(ADSREnvelope(&master->_filterEnv)), _filterEnvInvert(master->_filterEnvInvert) {
-    
-    _harmonicAmps.clear();
-    
-    SynthParameter* p;
-    for (int i = 0; i < _numHarmonics; i++) {
-        
-        char name[12];
-        sprintf(name, "Harmonic %d", i+1);
-        p = new SynthParameter(*master->_harmonicAmps[i]);
-        p->setRange(0.0f, 1.0f);
-        
-        _harmonicAmps.push_back(p);             // Store harmonic amplitudes in a vector
-        addParameter(p);                        // Add to the public parameter list
-    }
+SubtractiveSynthVoice::SubtractiveSynthVoice(const SubtractiveSynthVoice *master) : HarmonicSynthVoice(master), _filter(BiquadFilter(&master->_filter)), _filterEnv(ADSREnvelope(&master->_filterEnv)), _filterEnvInvert(master->_filterEnvInvert) {
     
     /* Get Fc and Q parameters from the filter to add to the parameter list */
     vector<SynthParameter*> params = _filter.getParameters();
@@ -101,43 +63,6 @@ SubtractiveSynthVoice::SubtractiveSynthVoice(SubtractiveSynthVoice *master) : Sy
         addParameter(params[i]);
 }
 
-void SubtractiveSynthVoice::setNumHarmonics(float num) {
-    
-    for (int i = 0; i < _numHarmonics; i++) {
-        
-        char name[12];
-        sprintf(name, "Harmonic %d", i+1);
-        removeParameter(name);
-    }
-    
-    _numHarmonics = num;
-    
-    /* Clear the harmonic amplitudes vector, and clear any harmonic amplitude params from the parameter list and sample update and sample rate listeners */
-    _harmonicAmps.clear();
-    for (int i = 0; i < _sampleRateListeners.size(); i++) {
-        
-    }
-    
-    SynthParameter* p;
-    for (int i = 0; i < _numHarmonics; i++) {
-        
-        char name[12];
-        sprintf(name, "Harmonic %d", i+1);
-        p = new SynthParameter(name, _fs, i == 0 ? 1.0f : 0.0f, 0.1f);
-        p->setRange(0.0f, 1.0f);
-        
-        _harmonicAmps.push_back(p);            // Store harmonic amplitudes in a vector
-        removeParameter(name);
-        addParameter(p);
-    }
-}
-
-void SubtractiveSynthVoice::setHarmonicAmp(int harmonicNumber, float amp) {
-    
-    if (harmonicNumber >= 1 && harmonicNumber <= _numHarmonics)
-        _harmonicAmps[harmonicNumber-1]->setValue(amp);
-}
-
 void SubtractiveSynthVoice::setFilterType(BiquadFilterType type) {
     
     _filter.setFilterType(type);
@@ -153,13 +78,7 @@ int SubtractiveSynthVoice::renderSample(float *outSample) {
     
     sampleUpdate();     // Ramp update any parameters added to the vector _sampleUpdateListeners
     
-    /* Add a value for each harmonic below 20kHz */
-    for (int n = 0; n < _numHarmonics; n++) {
-        _harmonicAmps[n]->ramp();        // Ramp the harmonic amplitudes if needed
-        if (_f0->value() * (n+1) < 20000.0f)
-            *outSample += (_harmonicAmps[n]->value() * sin((n+1) * _theta));
-    }
-    *outSample /= _numHarmonics;    // Normalize
+    *outSample += harmonicSample();             // Sum of harmonics below 20kHz
     
     *outSample *= _velAmp->value();             // Scale by current MIDI velocity-mapped amplitude
     *outSample *= _adsr.currentAmplitude();     // Scale by current envelope amplitude
@@ -172,20 +91,43 @@ int SubtractiveSynthVoice::renderSample(float *outSample) {
     return _adsr.update();          // Update the ADSR envelope state
 }
 
+int SubtractiveSynthVoice::renderBlock(float *outBuffer, int nFrames) {
+    
+    int cont = 1;
+    int i = 0;
+    
+    /* Render the harmonics in sub-blocks sized for the oscillator bank, then filter each sub-block */
+    while (i < nFrames && cont) {
+        
+        int n = std::min(nFrames - i, kHarmonicBank_MaxBlockSize);
+        cont = renderHarmonics(&outBuffer[i], n);
+        
+        /* Fc and Q were ramped once for the sub-block in renderHarmonics(), so the coefficients are recomputed at most once per sub-block */
+        _filter.filterBlock(&outBuffer[i], n);
+        
+        _filterEnv.update(NULL, n);
+        
+        i += n;
+    }
+    
+    /* Zero anything left over after the note ended */
+    for (; i < nFrames; i++)
+        outBuffer[i] = 0.0f;
+    
+    return cont;
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+int SubtractiveSynthVoice::renderBlockUnfiltered(float *outBuffer, int nFrames, BiquadFilter **filter) {
+    
+    int n = std::min(nFrames, kHarmonicBank_MaxBlockSize);
+    int cont = renderHarmonics(outBuffer, n);
+    
+    _filterEnv.update(NULL, n);
+    
+    /* Zero anything beyond one sub-block */
+    for (int j = n; j < nFrames; j++)
+        outBuffer[j] = 0.0f;
+    
+    *filter = &_filter;
+    return cont;
+}
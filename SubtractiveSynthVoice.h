@@ -11,13 +11,10 @@
 
 #include <stdio.h>
 
-#include "SynthVoice.h"
+#include "HarmonicSynthVoice.h"
 #include "BiquadFilter.h"
 
-class SubtractiveSynthVoice : public SynthVoice {
-    
-    int _numHarmonics;                              // Number of harmonics
-    std::vector<SynthParameter*> _harmonicAmps;     // Harmonic amplitudes
+class SubtractiveSynthVoice : public HarmonicSynthVoice {
     
     BiquadFilter _filter;
     ADSREnvelope _filterEnv;
@@ -28,18 +25,19 @@ public:
     SubtractiveSynthVoice();
     SubtractiveSynthVoice(int numHarmonics);
     SubtractiveSynthVoice(std::vector<float>harmonicAmps);
-    SubtractiveSynthVoice(SubtractiveSynthVoice *master);
+    SubtractiveSynthVoice(const SubtractiveSynthVoice *master);
     ~SubtractiveSynthVoice() {};
     
-    int numHarmonics()  { return _numHarmonics; }
+    SynthVoice* clone(void *mem) const { return new (mem) SubtractiveSynthVoice(this); }
+    size_t cloneSize() const { return sizeof(SubtractiveSynthVoice); }
     
-    void setNumHarmonics(float num);
-    void setHarmonicAmp(int harmonicNumber, float amp);
     void setFilterType(BiquadFilterType type);
     
     void beginAttack();
     
     int renderSample(float *outSample);
+    int renderBlock(float *outBuffer, int nFrames);
+    int renderBlockUnfiltered(float *outBuffer, int nFrames, BiquadFilter **filter);
 };
 
 #endif /* defined(__MRPSynthGUI__SubtractiveSynthVoice__) */
@@ -132,23 +132,19 @@
 
 - (IBAction)setFilterType:(NSSegmentedControl*)sender {
     
-    /* The filter type is not a key-value assigned parameter, so we need to get the master voice, modify it, then reset the master voice */
-    SubtractiveSynthVoice *voice = (SubtractiveSynthVoice *)_synth->masterVoice();
-    
+    /* The filter type is not a key-value assigned parameter. PolySynth sets it on the master voice and has the audio thread set it on the instance voices */
     switch ([sender selectedSegment]) {
             
         case 0:
-            voice->setFilterType(kBiquadFilterType_LowPass);
+            _synth->setFilterType(kBiquadFilterType_LowPass);
             break;
         case 1:
-            voice->setFilterType(kBiquadFilterType_HighPass);
+            _synth->setFilterType(kBiquadFilterType_HighPass);
             break;
         case 2:
-            voice->setFilterType(kBiquadFilterType_BandPass);
+            _synth->setFilterType(kBiquadFilterType_BandPass);
             break;
     }
-    
-    _synth->setMasterVoice(voice);
 }
 
 - (IBAction)setInvertFilterEnvelope:(NSButton*)sender {
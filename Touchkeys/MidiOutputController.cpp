@@ -46,6 +46,7 @@ bool MidiOutputController::openPort(int portNumber) {
 	try{
 		midiOut_.openPort(portNumber);
 		isOpen_ = true;
+		outputQueue_.setOutput(&midiOut_);
 	}
 	catch(...) {
 		return false;
@@ -64,6 +65,7 @@ bool MidiOutputController::openVirtualPort() {
 	try{
 		midiOut_.openVirtualPort("keycontrol");
 		isOpen_ = true;
+		outputQueue_.setOutput(&midiOut_);
 	}
 	catch(...) {
 		return false;
@@ -72,10 +74,11 @@ bool MidiOutputController::openVirtualPort() {
 	return true;
 }
 
-// Close a currently open MIDI port
+// Close a currently open MIDI port, sending anything still queued first
 void MidiOutputController::closePort() {
 	try {
 		isOpen_ = false;
+		outputQueue_.setOutput(0);
 		midiOut_.closePort();
 	}
 	catch(...) {}	
@@ -83,103 +86,110 @@ void MidiOutputController::closePort() {
 
 // Send a MIDI Note On message
 void MidiOutputController::sendNoteOn(unsigned char channel, unsigned char note, unsigned char velocity) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageNoteOn);
-	message.push_back(note & 0x7F);
-	message.push_back(velocity & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageNoteOn;
+	message[1] = note & 0x7F;
+	message[2] = velocity & 0x7F;
 	
-	sendMessage(&message);
+	queueMessage(message, 3);
 }
 
 // Send a MIDI Note Off message
 void MidiOutputController::sendNoteOff(unsigned char channel, unsigned char note) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageNoteOn);
-	message.push_back(note & 0x7F);
-	message.push_back(0);
+	message[0] = (channel & 0x0F) | kMidiMessageNoteOn;
+	message[1] = note & 0x7F;
+	message[2] = 0;
 	
-	sendMessage(&message);
+	queueMessage(message, 3);
 }
 
 // Send a MIDI Note Off message; second version supporting release velocity
 void MidiOutputController::sendNoteOff(unsigned char channel, unsigned char note, unsigned char velocity) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageNoteOff);
-	message.push_back(note & 0x7F);
-	message.push_back(velocity & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageNoteOff;
+	message[1] = note & 0x7F;
+	message[2] = velocity & 0x7F;
 	
-	sendMessage(&message);
+	queueMessage(message, 3);
 }
 
 // Send a MIDI Control Change message
 void MidiOutputController::sendControlChange(unsigned char channel, unsigned char control, unsigned char value) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageControlChange);
-	message.push_back(control & 0x7F);
-	message.push_back(value & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageControlChange;
+	message[1] = control & 0x7F;
+	message[2] = value & 0x7F;
 	
-	sendMessage(&message);	
+	queueMessage(message, 3);	
 }
 
 // Send a MIDI Program Change message
 void MidiOutputController::sendProgramChange(unsigned char channel, unsigned char value) {
-	vector<unsigned char> message;
+	unsigned char message[2];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageProgramChange);
-	message.push_back(value & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageProgramChange;
+	message[1] = value & 0x7F;
 	
-	sendMessage(&message);		
+	queueMessage(message, 2);		
 }
 
 // Send a Channel Aftertouch message
 void MidiOutputController::sendAftertouchChannel(unsigned char channel, unsigned char value) {
-	vector<unsigned char> message;
+	unsigned char message[2];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageAftertouchChannel);
-	message.push_back(value & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageAftertouchChannel;
+	message[1] = value & 0x7F;
 	
-	sendMessage(&message);		
+	queueMessage(message, 2);		
 }
 
 // Send a Polyphonic Aftertouch message
 void MidiOutputController::sendAftertouchPoly(unsigned char channel, unsigned char note, unsigned char value) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessageAftertouchPoly);
-	message.push_back(note & 0x7F);
-	message.push_back(value & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessageAftertouchPoly;
+	message[1] = note & 0x7F;
+	message[2] = value & 0x7F;
 	
-	sendMessage(&message);	
+	queueMessage(message, 3);	
 }
 
 // Send a Pitch Wheel message
 void MidiOutputController::sendPitchWheel(unsigned char channel, unsigned int value) {
-	vector<unsigned char> message;
+	unsigned char message[3];
 	
-	message.push_back((channel & 0x0F) | kMidiMessagePitchWheel);
-	message.push_back(value & 0x7F);
-	message.push_back((value >> 7) & 0x7F);
+	message[0] = (channel & 0x0F) | kMidiMessagePitchWheel;
+	message[1] = value & 0x7F;
+	message[2] = (value >> 7) & 0x7F;
 	
-	sendMessage(&message);		
+	queueMessage(message, 3);		
 }
 
 // Send a MIDI system reset message
 void MidiOutputController::sendReset() {
-	vector<unsigned char> message;
+	unsigned char message[1];
 	
-	message.push_back(kMidiMessageReset);
-	sendMessage(&message);
+	message[0] = kMidiMessageReset;
+	queueMessage(message, 1);
 }
 
-// Send a generic MIDI message (pre-formatted data)
+// Send a generic MIDI message (pre-formatted data). Short messages are
+// queued like the others; longer ones (sysex) are sent right away, after
+// anything already queued.
 void MidiOutputController::sendMessage(std::vector<unsigned char>* message) {
-	if(message == 0 || !isOpen_)
+	if(message == 0 || message->empty() || !isOpen_)
 		return;
 	
+	if(message->size() <= 3) {
+		queueMessage(&(*message)[0], (int)message->size());
+		return;
+	}
+	
 #ifdef MIDI_OUTPUT_CONTROLLER_DEBUG_RAW
 	cout << "MIDI Output: ";
 	for(int debugPrint = 0; debugPrint < message->size(); debugPrint++)
@@ -187,5 +197,14 @@ void MidiOutputController::sendMessage(std::vector<unsigned char>* message) {
 	cout << endl;
 #endif /* MIDI_OUTPUT_CONTROLLER_DEBUG_RAW */
 	
-	midiOut_.sendMessage(message);
+	outputQueue_.sendMessage(&(*message)[0], (int)message->size());
+}
+
+// Queue a message of at most three bytes for the output thread
+void MidiOutputController::queueMessage(const unsigned char* message, int size) {
+	if(!isOpen_)
+		return;
+	
+	// No debug output here: this is called from the TouchKeys and MIDI threads
+	outputQueue_.queueMessage(message, size);
 }
\ No newline at end of file
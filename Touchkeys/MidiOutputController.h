@@ -13,9 +13,10 @@
 #ifndef MIDI_OUTPUT_CONTROLLER_H
 #define MIDI_OUTPUT_CONTROLLER_H
 
-#define MIDI_OUTPUT_CONTROLLER_DEBUG_RAW
+//#define MIDI_OUTPUT_CONTROLLER_DEBUG_RAW
 
 #include "MidiInputController.h"
+#include "MidiOutputQueue.h"
 
 const string kMidiVirtualOutputName = "keycontrol";
 
@@ -52,12 +53,20 @@ public:
 	// Generic pre-formed messages
 	void sendMessage(std::vector<unsigned char>* message);
 	
+	// Send everything queued so far without waiting for the next flush
+	void flush() { outputQueue_.flush(); }
+	
 	// Destructor
 	~MidiOutputController() { closePort(); }
 	
 private:
+	// Queue a short message for the output thread, which coalesces
+	// controller/bend/aftertouch streams before sending
+	void queueMessage(const unsigned char* message, int size);
+	
 	RtMidiOut midiOut_;	// Output instance from RtMidi
 	bool isOpen_;			// Whether a port is currently open
+	MidiOutputQueue outputQueue_;	// Batches messages to midiOut_ from its own thread
 };
 
 #endif /* MIDI_OUTPUT_CONTROLLER_H */
\ No newline at end of file